@@ -0,0 +1,398 @@
+// bench_streaming.cpp
+// Replays a camera path through the tile selection and a tile loader against
+// an in-process server, without a window or GPU, and reports streaming
+// throughput.
+#include <StdIncludes.h>
+#include <stdio.h>
+#include <Enet.h>
+#include <Level.h>
+#include <Server.h>
+#include <PartChunk.h>
+#include <cxxopts.hpp>
+#include <gmtl/FrustumOps.h>
+#include <gmtl/Generate.h>
+#include <filesystem>
+#include <random>
+#include <set>
+#include <iostream>
+#include "FrustumTiles.h"
+#include "TileLoader.h"
+#include "LocMap.h"
+#ifdef _WIN32
+#define NOMINMAX
+#include <Windows.h>
+#include <Psapi.h>
+#else
+#include <sys/resource.h>
+#endif
+
+using namespace gmtl;
+
+namespace sam
+{
+    typedef std::chrono::steady_clock Clock;
+
+    // Same conventions as Camera::Fly: dir is yaw and pitch in radians,
+    // yaw 0 looks down +z.
+    struct PathPoint
+    {
+        double t;
+        Point3f pos;
+        Vec2f dir;
+    };
+
+    class CameraPath
+    {
+        std::vector<PathPoint> m_points;
+    public:
+        // Lines of "t x y z yaw pitch", sorted by t.
+        bool Load(const std::string& file)
+        {
+            std::ifstream in(file);
+            PathPoint pt;
+            while (in >> pt.t >> pt.pos[0] >> pt.pos[1] >> pt.pos[2] >> pt.dir[0] >> pt.dir[1])
+                m_points.push_back(pt);
+            return m_points.size() >= 2;
+        }
+
+        // A straight run down +z with the view sweeping side to side.
+        void Script(double seconds, float speed, float height)
+        {
+            for (double t = 0; t <= seconds + 0.5; t += 0.5)
+            {
+                PathPoint pt;
+                pt.t = t;
+                pt.pos = Point3f(0, height, (float)(t * speed));
+                pt.dir = Vec2f(0.4f * sinf((float)t * 0.5f), -0.1f);
+                m_points.push_back(pt);
+            }
+        }
+
+        double Duration() const { return m_points.back().t; }
+
+        PathPoint At(double t) const
+        {
+            auto it = std::lower_bound(m_points.begin(), m_points.end(), t,
+                [](const PathPoint& p, double t) { return p.t < t; });
+            if (it == m_points.begin())
+                return m_points.front();
+            if (it == m_points.end())
+                return m_points.back();
+            const PathPoint& b = *it;
+            const PathPoint& a = *(it - 1);
+            float f = (float)((t - a.t) / std::max(b.t - a.t, 1e-6));
+            PathPoint pt;
+            pt.t = t;
+            pt.pos = a.pos + (b.pos - a.pos) * f;
+            pt.dir = a.dir + (b.dir - a.dir) * f;
+            return pt;
+        }
+
+        // The view Camera would build for this point.
+        static TileView View(const PathPoint& pt, float aspect)
+        {
+            TileView view;
+            view.pos = pt.pos;
+            Vec3f& right = view.dirs[0];
+            Vec3f& up = view.dirs[1];
+            Vec3f& forward = view.dirs[2];
+            forward = make<Quatf>(AxisAnglef(pt.dir[1], -1.0f, 0.0f, 0.0f)) * Vec3f(0, 0, 1);
+            forward = make<Quatf>(AxisAnglef(pt.dir[0], 0.0f, -1.0f, 0.0f)) * forward;
+            normalize(forward);
+            cross(right, forward, Vec3f(0, 1, 0));
+            normalize(right);
+            cross(up, forward, right);
+            normalize(up);
+
+            Matrix44f rot, off;
+            rot.set(
+                right[0], right[1], right[2], 0,
+                up[0], up[1], up[2], 0,
+                forward[0], forward[1], forward[2], 0,
+                0, 0, 0, 1);
+            transpose(rot);
+            setTrans(off, pt.pos);
+            Matrix44f viewMat = off * rot;
+            invert(viewMat);
+            setPerspective(view.proj, 60.0f, aspect, FrustumTiles::NearDist, FrustumTiles::FarDist);
+            view.frustum = Frustumf(viewMat, view.proj);
+            normalize(view.frustum);
+            return view;
+        }
+    };
+
+    // Fills the ground tiles within radius level 8 tiles of the path with
+    // random bricks, so fetches carry realistic payloads.
+    static void GenerateLevel(const std::string& path, const CameraPath& camPath,
+        int radius, int partsPerTile)
+    {
+        std::filesystem::remove_all(path);
+        LevelSvr level(false);
+        level.OpenDb(path);
+        std::mt19937 rng(1);
+        std::uniform_real_distribution<float> coord(-7.5f, 7.5f);
+        std::uniform_int_distribution<int> height(0, 7);
+        std::set<Loc> tiles;
+        for (double t = 0; t <= camPath.Duration(); t += 0.25)
+        {
+            Loc center = Loc::FromPoint(camPath.At(t).pos, 8).GetGroundLoc();
+            for (int dx = -radius; dx <= radius; ++dx)
+            {
+                for (int dz = -radius; dz <= radius; ++dz)
+                    tiles.insert(Loc(center.m_x + dx, center.m_y, center.m_z + dz, 8));
+            }
+        }
+
+        std::vector<std::pair<std::string, std::string>> batch;
+        for (const Loc& l : tiles)
+        {
+            std::vector<PartInst> parts;
+            for (int idx = 0; idx < partsPerTile; ++idx)
+            {
+                PartInst pi;
+                pi.id = "3001";
+                pi.atlasidx = 0;
+                pi.pos = Vec3f(coord(rng), height(rng) * 1.2f - 0.5f, coord(rng));
+                pi.rot = Quatf();
+                pi.connected = true;
+                pi.canBeDestroyed = true;
+                parts.push_back(pi);
+            }
+            ILevel::OctKey key(l, 0);
+            std::string val;
+            PartChunk::Encode(parts, &val);
+            batch.push_back(std::make_pair(std::string((const char*)&key, sizeof(key)), std::move(val)));
+            if (batch.size() >= 256)
+            {
+                level.WriteValues(batch);
+                batch.clear();
+            }
+        }
+        if (batch.size() > 0)
+            level.WriteValues(batch);
+        level.CloseDb();
+        std::cout << "Generated " << tiles.size() << " tiles in " << path << std::endl;
+    }
+
+    // Tiles load through the game's TileLoad and TileLoader.  Only the
+    // bricks are left out, those need the renderer.
+    struct LoadStats
+    {
+        std::atomic<uint64_t> bytes{ 0 };
+        uint64_t tilesReady = 0;
+        std::vector<double> readyMillis;
+    };
+
+    class BenchTile : public TileLoad
+    {
+        LoadStats* m_stats;
+    public:
+        BenchTile(const Loc& l, LoadStats* stats) :
+            TileLoad(l),
+            m_stats(stats),
+            added(Clock::now()) {}
+        Clock::time_point added;
+
+    protected:
+        void OnFetched(const PacketBuffer& buf, LoadedParts& loaded) override
+        {
+            m_stats->bytes += buf.size();
+        }
+    };
+
+    static double Percentile(std::vector<double> vals, double p)
+    {
+        if (vals.size() == 0)
+            return 0;
+        size_t idx = std::min((size_t)(p * vals.size()), vals.size() - 1);
+        std::nth_element(vals.begin(), vals.begin() + idx, vals.end());
+        return vals[idx];
+    }
+
+    static double PeakRssMb()
+    {
+#ifdef _WIN32
+        PROCESS_MEMORY_COUNTERS pmc;
+        GetProcessMemoryInfo(GetCurrentProcess(), &pmc, sizeof(pmc));
+        return pmc.PeakWorkingSetSize / (1024.0 * 1024.0);
+#else
+        rusage usage;
+        getrusage(RUSAGE_SELF, &usage);
+#ifdef __APPLE__
+        return usage.ru_maxrss / (1024.0 * 1024.0);
+#else
+        return usage.ru_maxrss / 1024.0;
+#endif
+#endif
+    }
+
+    struct BenchOptions
+    {
+        int fps = 60;
+        int maxlod = 8;
+        int loaders = 4;
+        double drainSeconds = 10;
+    };
+
+    // Returns false if nothing was loaded.
+    static bool RunBench(ILevel* level, const CameraPath& camPath, const BenchOptions& opts)
+    {
+        const float aspect = 16.0f / 9.0f;
+        const int fetchLevel = 5;
+        FrustumTiles frustumTiles;
+        LodPolicy policy;
+        LocMap<std::shared_ptr<BenchTile>> tiles;
+        std::set<Loc> activeTiles;
+        LoadStats stats;
+        TileLoader loader(opts.loaders);
+
+        size_t frames = 0;
+        double selectMicros = 0, maxSelectMicros = 0;
+        Clock::time_point start = Clock::now();
+        Clock::time_point drainEnd = start + std::chrono::duration_cast<Clock::duration>(
+            std::chrono::duration<double>(camPath.Duration() + opts.drainSeconds));
+        while (true)
+        {
+            Clock::time_point frameStart = start + std::chrono::duration_cast<Clock::duration>(
+                std::chrono::duration<double>((double)frames / opts.fps));
+            std::this_thread::sleep_until(frameStart);
+            double t = std::min((double)frames / opts.fps, camPath.Duration());
+            PathPoint pt = camPath.At(t);
+            Vec3f boundsExt(0.01f, 0.01f, 0.01f);
+            AABoxf playerBounds(pt.pos - boundsExt, pt.pos + boundsExt);
+
+            std::vector<Loc> added, removed;
+            Clock::time_point selectStart = Clock::now();
+            frustumTiles.Update(CameraPath::View(pt, aspect), opts.maxlod, policy, playerBounds, added, removed);
+            double micros = std::chrono::duration<double, std::micro>(Clock::now() - selectStart).count();
+            selectMicros += micros;
+            maxSelectMicros = std::max(maxSelectMicros, micros);
+
+            for (const auto& l : removed)
+                activeTiles.erase(l);
+            for (const auto& l : added)
+            {
+                if (l.m_l >= fetchLevel && tiles.find(l) == tiles.end())
+                    tiles.insert(std::make_pair(l, std::make_shared<BenchTile>(l, &stats)));
+                activeTiles.insert(l);
+            }
+            for (const auto& l : removed)
+            {
+                if (activeTiles.find(l) == activeTiles.end())
+                    tiles.erase(l);
+            }
+
+            // What OctTile::AcceptLoaded and Draw do with a loaded tile.
+            std::vector<TileLoader::Request> requests;
+            bool pending = false;
+            for (auto it = tiles.begin(); it != tiles.end(); ++it)
+            {
+                BenchTile& tile = *it->second;
+                if (tile.TakeLoaded() != nullptr)
+                {
+                    tile.SetGpuReady();
+                    stats.tilesReady++;
+                    stats.readyMillis.push_back(std::chrono::duration<double, std::milli>(
+                        Clock::now() - tile.added).count());
+                }
+                if (tile.GetState() == TileLoad::State::Queued)
+                    requests.push_back(TileLoader::Request{ LoadPriority(it->first, pt.pos), it->second });
+                pending |= tile.GetState() != TileLoad::State::GpuReady;
+            }
+            loader.SetRequests(level, requests);
+            frames++;
+
+            if (t >= camPath.Duration() && (!pending || Clock::now() >= drainEnd))
+            {
+                if (pending)
+                    std::cout << "Tiles still loading after " << opts.drainSeconds << "s drain" << std::endl;
+                break;
+            }
+        }
+
+        double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+        printf("frames: %zu\n", frames);
+        printf("seconds: %.2f\n", seconds);
+        printf("select_us_avg: %.1f\n", frames > 0 ? selectMicros / frames : 0);
+        printf("select_us_max: %.1f\n", maxSelectMicros);
+        printf("tiles_ready: %llu\n", (unsigned long long)stats.tilesReady);
+        printf("tiles_per_sec: %.1f\n", stats.tilesReady / seconds);
+        printf("ready_ms_p50: %.1f\n", Percentile(stats.readyMillis, 0.5));
+        printf("ready_ms_p99: %.1f\n", Percentile(stats.readyMillis, 0.99));
+        printf("payload_bytes: %llu\n", (unsigned long long)stats.bytes);
+        printf("peak_rss_mb: %.1f\n", PeakRssMb());
+        return stats.tilesReady > 0;
+    }
+}
+
+int main(int argc, char** argv)
+{
+    cxxopts::Options options("bench_streaming", "Measures tile streaming against an in-process server");
+    options.add_options()
+        ("l,level", "Use this level instead of generating one", cxxopts::value<std::string>())
+        ("path", "Camera path file, lines of \"t x y z yaw pitch\"", cxxopts::value<std::string>())
+        ("seconds", "Length of the scripted path (default: 20)", cxxopts::value<double>())
+        ("speed", "Scripted camera speed in units per second (default: 8)", cxxopts::value<float>())
+        ("height", "Scripted camera height (default: 2)", cxxopts::value<float>())
+        ("radius", "Generated level radius around the path in level 8 tiles (default: 16)", cxxopts::value<int>())
+        ("parts", "Parts per generated tile (default: 64)", cxxopts::value<int>())
+        ("fps", "Frames per second to replay at (default: 60)", cxxopts::value<int>())
+        ("loaders", "Loader threads (default: as the game picks)", cxxopts::value<int>())
+        ("p,port", "Port for the in-process server (default: 8100)", cxxopts::value<int>())
+        ("h,help", "Print usage")
+        ;
+
+    auto result = options.parse(argc, argv);
+    if (result.count("help"))
+    {
+        std::cout << options.help() << std::endl;
+        return 0;
+    }
+
+    sam::CameraPath camPath;
+    if (result.count("path"))
+    {
+        if (!camPath.Load(result["path"].as<std::string>()))
+        {
+            std::cerr << "Couldn't read camera path" << std::endl;
+            return 1;
+        }
+    }
+    else
+    {
+        double seconds = result.count("seconds") ? result["seconds"].as<double>() : 20.0;
+        float speed = result.count("speed") ? result["speed"].as<float>() : 8.0f;
+        float height = result.count("height") ? result["height"].as<float>() : 2.0f;
+        camPath.Script(seconds, speed, height);
+    }
+
+    std::string levelPath;
+    if (result.count("level"))
+        levelPath = result["level"].as<std::string>();
+    else
+    {
+        levelPath = (std::filesystem::temp_directory_path() / "bench_streaming_lvl").string();
+        int radius = result.count("radius") ? result["radius"].as<int>() : 16;
+        int parts = result.count("parts") ? result["parts"].as<int>() : 64;
+        sam::GenerateLevel(levelPath, camPath, radius, parts);
+    }
+
+    sam::BenchOptions opts;
+    opts.loaders = sam::TileLoader::DefaultThreads();
+    if (result.count("loaders"))
+        opts.loaders = std::max(result["loaders"].as<int>(), 1);
+    if (result.count("fps"))
+        opts.fps = std::max(result["fps"].as<int>(), 1);
+    int port = result.count("port") ? result["port"].as<int>() : 8100;
+
+    bool ok;
+    {
+        sam::Server server;
+        server.Start(levelPath, "localhost", port);
+        sam::ENetClient client("localhost", port);
+        sam::LevelCli level;
+        level.Connect(&client);
+        ok = sam::RunBench(&level, camPath, opts);
+    }
+    return ok ? 0 : 1;
+}
\ No newline at end of file
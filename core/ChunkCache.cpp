@@ -0,0 +1,138 @@
+#include "StdIncludes.h"
+#include "ChunkCache.h"
+
+namespace sam
+{
+    ChunkCache::ChunkCache(size_t budget, size_t numShards) :
+        m_shardBudget(budget / numShards),
+        m_hits(0),
+        m_misses(0),
+        m_evictions(0)
+    {
+        for (size_t idx = 0; idx < numShards; ++idx)
+            m_shards.push_back(std::make_unique<Shard>());
+    }
+
+    ChunkCache::~ChunkCache()
+    {
+        Clear();
+    }
+
+    ChunkCache::Shard& ChunkCache::ShardFor(const ILevel::OctKey& key)
+    {
+        return *m_shards[ILevel::OctKey::Hash()(key) % m_shards.size()];
+    }
+
+    size_t ChunkCache::EntrySize(const PacketBuffer& val)
+    {
+        // Charges what the entry keeps alive, which for a slice of a batched
+        // response is the whole packet.
+        return val.ownerSize() + sizeof(EntryList::node);
+    }
+
+    void ChunkCache::Remove(Shard& shard, EntryList::node* node)
+    {
+        shard.lru.unlink(node);
+        shard.map.erase(node->data.key);
+        shard.bytes -= EntrySize(node->data.val);
+        delete node;
+    }
+
+    bool ChunkCache::Get(const ILevel::OctKey& key, PacketBuffer* val)
+    {
+        Shard& shard = ShardFor(key);
+        std::lock_guard lock(shard.mtx);
+        auto itNode = shard.map.find(key);
+        if (itNode == shard.map.end())
+        {
+            m_misses++;
+            return false;
+        }
+        EntryList::node* node = itNode->second;
+        shard.lru.unlink(node);
+        shard.lru.insert_front(node);
+        *val = node->data.val;
+        m_hits++;
+        return true;
+    }
+
+    bool ChunkCache::Contains(const ILevel::OctKey& key)
+    {
+        Shard& shard = ShardFor(key);
+        std::lock_guard lock(shard.mtx);
+        return shard.map.find(key) != shard.map.end();
+    }
+
+    void ChunkCache::Put(const ILevel::OctKey& key, const PacketBuffer& val)
+    {
+        Shard& shard = ShardFor(key);
+        std::lock_guard lock(shard.mtx);
+        auto itNode = shard.map.find(key);
+        if (itNode != shard.map.end())
+            Remove(shard, itNode->second);
+        Insert(shard, key, val);
+    }
+
+    bool ChunkCache::Add(const ILevel::OctKey& key, const PacketBuffer& val)
+    {
+        Shard& shard = ShardFor(key);
+        std::lock_guard lock(shard.mtx);
+        if (shard.map.find(key) != shard.map.end())
+            return false;
+        Insert(shard, key, val);
+        return true;
+    }
+
+    void ChunkCache::Insert(Shard& shard, const ILevel::OctKey& key, const PacketBuffer& val)
+    {
+        // A small slice of a large batched response is copied out, rather
+        // than pin the packet for as long as it's cached.
+        bool copy = val.ownerSize() > val.size() * 2;
+        EntryList::node* node = new EntryList::node(Entry{ key, copy ? val.Copy() : val });
+        shard.lru.insert_front(node);
+        shard.map.insert(std::make_pair(key, node));
+        shard.bytes += EntrySize(node->data.val);
+
+        while (shard.bytes > m_shardBudget && shard.lru.tail != node)
+        {
+            Remove(shard, shard.lru.tail);
+            m_evictions++;
+        }
+    }
+
+    void ChunkCache::Invalidate(const ILevel::OctKey& key)
+    {
+        Shard& shard = ShardFor(key);
+        std::lock_guard lock(shard.mtx);
+        auto itNode = shard.map.find(key);
+        if (itNode != shard.map.end())
+            Remove(shard, itNode->second);
+    }
+
+    void ChunkCache::Clear()
+    {
+        for (auto& shard : m_shards)
+        {
+            std::lock_guard lock(shard->mtx);
+            while (shard->lru.head != nullptr)
+                Remove(*shard, shard->lru.head);
+        }
+    }
+
+    ChunkCache::Stats ChunkCache::GetStats() const
+    {
+        Stats stats;
+        stats.hits = m_hits;
+        stats.misses = m_misses;
+        stats.evictions = m_evictions;
+        stats.bytes = 0;
+        stats.entries = 0;
+        for (auto& shard : m_shards)
+        {
+            std::lock_guard lock(shard->mtx);
+            stats.bytes += shard->bytes;
+            stats.entries += shard->map.size();
+        }
+        return stats;
+    }
+}
@@ -0,0 +1,68 @@
+#pragma once
+
+#include <mutex>
+#include <atomic>
+#include <unordered_map>
+#include "Level.h"
+#include "dbl_list.h"
+
+namespace sam
+{
+    // Client side cache of tile chunks, bounded by a byte budget.  Keys are
+    // spread over shards that each keep their own LRU list and lock, so the
+    // loader and render threads rarely contend.
+    class ChunkCache
+    {
+    public:
+        struct Stats
+        {
+            uint64_t hits;
+            uint64_t misses;
+            uint64_t evictions;
+            size_t bytes;
+            size_t entries;
+        };
+
+        ChunkCache(size_t budget, size_t numShards = 16);
+        ~ChunkCache();
+
+        bool Get(const ILevel::OctKey& key, PacketBuffer* val);
+        // Like Get without the copy or counting a hit or miss.
+        bool Contains(const ILevel::OctKey& key);
+        void Put(const ILevel::OctKey& key, const PacketBuffer& val);
+        // Like Put, but an existing entry is newer and is kept.  Returns
+        // whether val was added.
+        bool Add(const ILevel::OctKey& key, const PacketBuffer& val);
+        void Invalidate(const ILevel::OctKey& key);
+        void Clear();
+        Stats GetStats() const;
+
+    private:
+        struct Entry
+        {
+            ILevel::OctKey key;
+            PacketBuffer val;
+        };
+        typedef dbl_list<Entry> EntryList;
+
+        struct Shard
+        {
+            Shard() : bytes(0) {}
+            std::mutex mtx;
+            std::unordered_map<ILevel::OctKey, EntryList::node*, ILevel::OctKey::Hash> map;
+            EntryList lru;
+            size_t bytes;
+        };
+
+        Shard& ShardFor(const ILevel::OctKey& key);
+        static size_t EntrySize(const PacketBuffer& val);
+        void Remove(Shard& shard, EntryList::node* node);
+        void Insert(Shard& shard, const ILevel::OctKey& key, const PacketBuffer& val);
+
+        std::vector<std::unique_ptr<Shard>> m_shards;
+        size_t m_shardBudget;
+        std::atomic<uint64_t> m_hits;
+        std::atomic<uint64_t> m_misses;
+        std::atomic<uint64_t> m_evictions;
+    };
+}
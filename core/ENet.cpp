@@ -4,6 +4,7 @@
 #include "nlohmann/json.hpp"
 #include "zip.h"
 #include <enet/enet.h>
+#include <algorithm>
 
 using namespace nlohmann;
 using namespace gmtl;
@@ -11,6 +12,15 @@ using namespace gmtl;
 namespace sam
 {
     std::atomic<size_t> ENetMsg::m_nextUid(100);
+
+    PacketBuffer::PacketBuffer(ENetPacket* packet, size_t offset, size_t size) :
+        m_owner(packet, enet_packet_destroy),
+        m_data((const char*)packet->data + offset),
+        m_size(size),
+        m_ownerSize(packet->dataLength)
+    {
+    }
+
     ENetClient::ENetClient(const std::string& svr, uint16_t port) :
         m_port(port),
         m_server(svr),
@@ -63,6 +73,12 @@ namespace sam
         m_queuedMsg.push_back(std::move(qm));
     }
 
+    void ENetClient::OnNotify(const std::function<void(const ENetMsg::Header* msg)>& func)
+    {
+        std::lock_guard lock(m_queueLock);
+        m_notifyFn = func;
+    }
+
     void ENetClient::BackgroundThread()
     {
         ENetAddress address;        
@@ -134,20 +150,33 @@ namespace sam
                 case ENET_EVENT_TYPE_RECEIVE:
                 {
                     ENetResponseHdr* hdr = (ENetResponseHdr*)evt.packet->data;
+                    if (hdr->m_uid == ENetResponseHdr::NotifyUid)
+                    {
+                        std::function<void(const ENetMsg::Header* msg)> notifyFn;
+                        {
+                            std::lock_guard lock(m_queueLock);
+                            notifyFn = m_notifyFn;
+                        }
+                        if (notifyFn != nullptr)
+                            notifyFn((const ENetMsg::Header*)(evt.packet->data + sizeof(ENetResponseHdr)));
+                        enet_packet_destroy(evt.packet);
+                        break;
+                    }
                     auto itResp = m_waitingResponse.find(hdr->m_uid);
                     if (itResp != m_waitingResponse.end())
                     {
+                        // The response takes ownership of the packet, the payload
+                        // is handed out in place.
                         ENetResponse resp;
-                        resp.data.resize(hdr->m_size);
-                        memcpy(resp.data.data(), evt.packet->data + sizeof(ENetResponseHdr),
-                            resp.data.size());
+                        resp.data = PacketBuffer(evt.packet, sizeof(ENetResponseHdr), hdr->m_size);
                         if (itResp->second.response)
                             itResp->second.response->set_value(resp);
                         if (itResp->second.callback != nullptr)
                             itResp->second.callback(resp);
                         m_waitingResponse.erase(itResp);
                     }
-                    enet_packet_destroy(evt.packet);
+                    else
+                        enet_packet_destroy(evt.packet);
                     break;
                 }
 
@@ -173,23 +202,235 @@ namespace sam
         }
     }
 
-    ENetServer::ENetServer(const std::string& hostaddr, uint16_t port, IServerHandler* pHandler) :
+    struct ENetServer::Wakeup
+    {
+        ENetSocket socket = ENET_SOCKET_NULL;
+        ENetAddress address;
+    };
+
+    ENetServer::ENetServer(const std::string& hostaddr, uint16_t port, IServerHandler* pHandler, size_t numWorkers) :
         m_hostaddr(hostaddr),
         m_port(port),
-        m_svrHandler(pHandler)
+        m_svrHandler(pHandler),
+        m_enetHost(nullptr),
+        m_numWorkers(numWorkers),
+        m_terminate(false),
+        m_wakeup(std::make_unique<Wakeup>()),
+        m_notifyBytes(0),
+        m_maxPeerDepth(0)
     {
+        if (m_numWorkers == 0)
+            m_numWorkers = std::max(1u, std::thread::hardware_concurrency());
     }
 
     void ENetServer::Start()
     {
+        for (size_t idx = 0; idx < m_numWorkers; ++idx)
+        {
+            m_workers.push_back(std::thread(std::bind(&ENetServer::WorkerThread, this, idx == 0)));
+        }
         std::thread t1(std::bind(&ENetServer::BackgroundThread, this));
         m_thread.swap(t1);        
     }
 
     ENetServer::~ENetServer()
     {
-        enet_host_destroy(m_enetHost);
-        m_thread.join();
+        Stop();
+        if (m_enetHost != nullptr)
+            enet_host_destroy(m_enetHost);
+        // Destroyed last, workers may send to it until they exit.
+        if (m_wakeup->socket != ENET_SOCKET_NULL)
+            enet_socket_destroy(m_wakeup->socket);
+    }
+
+    void ENetServer::RequestStop()
+    {
+        m_terminate = true;
+    }
+
+    void ENetServer::Wait()
+    {
+        if (m_thread.joinable())
+            m_thread.join();
+    }
+
+    void ENetServer::Stop()
+    {
+        {
+            std::lock_guard lock(m_jobMtx);
+            m_terminate = true;
+        }
+        m_jobCv.notify_all();
+        Wait();
+        for (auto& worker : m_workers)
+            worker.join();
+        m_workers.clear();
+        // Both threads are gone, send what the workers finished.
+        if (m_enetHost != nullptr)
+        {
+            SendCompletions();
+            enet_host_flush(m_enetHost);
+        }
+    }
+
+    void ENetServer::WorkerThread(bool handlesOrdered)
+    {
+        std::unique_lock<std::mutex> lk(m_jobMtx);
+        while (true)
+        {
+            m_jobCv.wait(lk, [this, handlesOrdered]() {
+                return m_terminate || m_jobs.size() > 0 ||
+                    (handlesOrdered && m_orderedJobs.size() > 0); });
+            bool hasJob = m_jobs.size() > 0 ||
+                (handlesOrdered && m_orderedJobs.size() > 0);
+            // Drain the queue before exiting so accepted writes are not lost.
+            if (!hasJob)
+                break;
+            Job job;
+            if (handlesOrdered && m_orderedJobs.size() > 0)
+            {
+                job = m_orderedJobs.front();
+                m_orderedJobs.pop_front();
+            }
+            else
+            {
+                job = m_jobs.front();
+                m_jobs.pop_front();
+            }
+            lk.unlock();
+
+            m_queueWait.Add(ScopedLatency::MicrosSince(job.received));
+            ENetMsg::Header* msg = (ENetMsg::Header*)job.packet->data;
+            ENetResponse resp;
+            if (msg->m_type == ENetMsg::Type::GetStats)
+                resp.data = PacketBuffer(GetStats());
+            else
+                resp = m_svrHandler->HandleMessage(msg);
+            ENetResponseHdr ehdr;
+            ehdr.m_size = resp.data.size();
+            ehdr.m_uid = msg->m_uid;
+            ENetPacket* packet = enet_packet_create(nullptr, sizeof(ENetResponseHdr) + resp.data.size(), ENET_PACKET_FLAG_RELIABLE);
+            memcpy(packet->data, &ehdr, sizeof(ENetResponseHdr));
+            memcpy(packet->data + sizeof(ENetResponseHdr), resp.data.data(), resp.data.size());
+            TypeStats& stats = StatsFor(msg->m_type);
+            stats.bytesIn += job.packet->dataLength;
+            stats.bytesOut += packet->dataLength;
+            stats.latency.Add(ScopedLatency::MicrosSince(job.received));
+            enet_packet_destroy(job.packet);
+            bool wake;
+            {
+                std::lock_guard lock(m_completionMtx);
+                m_completions.push_back(Completion{ job.peer, packet, resp.notify });
+                // Later ones are taken along with the first.
+                wake = m_completions.size() == 1;
+            }
+            if (wake)
+                Wake();
+            lk.lock();
+        }
+    }
+
+    void ENetServer::SendCompletions()
+    {
+        std::vector<Completion> completions;
+        {
+            std::lock_guard lock(m_completionMtx);
+            std::swap(completions, m_completions);
+        }
+        for (Completion& c : completions)
+        {
+            auto itDepth = m_peerDepth.find(c.peer);
+            if (itDepth != m_peerDepth.end() && --itDepth->second == 0)
+                m_peerDepth.erase(itDepth);
+            // The peer may have dropped while its request was being handled.
+            if (m_peers.find(c.peer) == m_peers.end())
+            {
+                enet_packet_destroy(c.packet);
+                continue;
+            }
+            enet_peer_send(c.peer, 0, c.packet);
+            if (c.notify != nullptr)
+                Notify(c.peer, *c.notify);
+        }
+    }
+
+    void ENetServer::Wake()
+    {
+        char byte = 0;
+        ENetBuffer buf;
+        buf.data = &byte;
+        buf.dataLength = sizeof(byte);
+        enet_socket_send(m_wakeup->socket, &m_wakeup->address, &buf, 1);
+    }
+
+    void ENetServer::WaitForWork(uint32_t timeoutMs)
+    {
+        ENetSocketSet readSet;
+        ENET_SOCKETSET_EMPTY(readSet);
+        ENET_SOCKETSET_ADD(readSet, m_enetHost->socket);
+        ENET_SOCKETSET_ADD(readSet, m_wakeup->socket);
+        ENetSocket maxSocket = std::max(m_enetHost->socket, m_wakeup->socket);
+        if (enet_socketset_select(maxSocket, &readSet, nullptr, timeoutMs) <= 0)
+            return;
+        if (!ENET_SOCKETSET_CHECK(readSet, m_wakeup->socket))
+            return;
+        char bytes[64];
+        ENetBuffer buf;
+        buf.data = bytes;
+        buf.dataLength = sizeof(bytes);
+        while (enet_socket_receive(m_wakeup->socket, nullptr, &buf, 1) > 0)
+            ;
+    }
+
+    ENetServer::TypeStats& ENetServer::StatsFor(int type)
+    {
+        std::lock_guard lock(m_statsMtx);
+        std::unique_ptr<TypeStats>& stats = m_typeStats[type];
+        if (stats == nullptr)
+            stats = std::make_unique<TypeStats>();
+        return *stats;
+    }
+
+    std::string ENetServer::GetStats() const
+    {
+        std::ostringstream ss;
+        size_t queued;
+        {
+            std::lock_guard lock(m_jobMtx);
+            queued = m_jobs.size() + m_orderedJobs.size();
+        }
+        ss << "== Server ==" << std::endl;
+        ss << "workers: " << m_numWorkers << " queued: " << queued
+            << " max peer depth: " << m_maxPeerDepth << std::endl;
+        ss << "notify bytes out: " << m_notifyBytes << std::endl;
+        ss << "-- queue wait (us) --" << std::endl << m_queueWait.ToString();
+        {
+            std::lock_guard lock(m_statsMtx);
+            for (const auto& kv : m_typeStats)
+            {
+                ss << "-- msg type " << kv.first << ": " << kv.second->latency.Count() << " requests, "
+                    << kv.second->bytesIn << " bytes in, " << kv.second->bytesOut << " bytes out (us) --"
+                    << std::endl << kv.second->latency.ToString();
+            }
+        }
+        return ss.str() + m_svrHandler->GetStats();
+    }
+
+    void ENetServer::Notify(ENetPeer* sender, ENetMsg& msg)
+    {
+        ENetResponseHdr ehdr;
+        ehdr.m_size = msg.GetSize();
+        ehdr.m_uid = ENetResponseHdr::NotifyUid;
+        for (ENetPeer* peer : m_peers)
+        {
+            if (peer == sender)
+                continue;
+            ENetPacket* packet = enet_packet_create(nullptr, sizeof(ENetResponseHdr) + ehdr.m_size, ENET_PACKET_FLAG_RELIABLE);
+            memcpy(packet->data, &ehdr, sizeof(ENetResponseHdr));
+            msg.WriteData(packet->data + sizeof(ENetResponseHdr));
+            m_notifyBytes += packet->dataLength;
+            enet_peer_send(peer, 0, packet);
+        }
     }
 
     void ENetServer::BackgroundThread()
@@ -220,12 +461,31 @@ namespace sam
             exit(EXIT_FAILURE);
         }
 
+        m_wakeup->socket = enet_socket_create(ENET_SOCKET_TYPE_DATAGRAM);
+        enet_address_set_host(&m_wakeup->address, "127.0.0.1");
+        m_wakeup->address.port = 0;
+        if (m_wakeup->socket == ENET_SOCKET_NULL ||
+            enet_socket_bind(m_wakeup->socket, &m_wakeup->address) < 0 ||
+            enet_socket_get_address(m_wakeup->socket, &m_wakeup->address) < 0) {
+            fprintf(stderr, "An error occured while trying to create the server's wakeup socket\n");
+            exit(EXIT_FAILURE);
+        }
+        enet_socket_set_option(m_wakeup->socket, ENET_SOCKOPT_NONBLOCK, 1);
+
         // c. Connect and user service
         eventStatus = 1;
 
         printf("(Server) start host\n");
-        while (1) {
-            eventStatus = enet_host_service(m_enetHost, &evt, 50000);
+        while (!m_terminate) {
+            SendCompletions();
+            // Sends what SendCompletions queued without blocking.  With no
+            // event, sleep until a packet arrives or a worker wakes us.
+            eventStatus = enet_host_service(m_enetHost, &evt, 0);
+            if (eventStatus == 0)
+            {
+                WaitForWork(100);
+                continue;
+            }
 
             // If we had some evt that interested us
             if (eventStatus > 0) {
@@ -236,34 +496,41 @@ namespace sam
                         (evt.peer->address.host >> 16) & 255,
                         (evt.peer->address.host >> 8) & 255,
                         (evt.peer->address.host >> 0) & 255);
+                    m_peers.insert(evt.peer);
                     break;
 
                 case ENET_EVENT_TYPE_RECEIVE:
                 {
                     ENetMsg::Header* msg = (ENetMsg::Header*)evt.packet->data;
-                    ENetResponse resp = m_svrHandler->HandleMessage(msg);                    
-                    std::string rdata;
-                    rdata.resize(sizeof(ENetResponseHdr) + resp.data.size());
-                    ENetResponseHdr ehdr;
-                    ehdr.m_size = resp.data.size();
-                    ehdr.m_uid = msg->m_uid;
-                    memcpy(rdata.data(), &ehdr, sizeof(ENetResponseHdr));
-                    memcpy(rdata.data() + sizeof(ENetResponseHdr), resp.data.data(), resp.data.size());
-                    ENetPacket* packet = enet_packet_create(rdata.data(), rdata.size(), ENET_PACKET_FLAG_RELIABLE);
-                    enet_peer_send(evt.peer, 0, packet);
-                    enet_packet_destroy(evt.packet);
+                    bool ordered = m_svrHandler->IsOrdered(msg);
+                    Job job{ evt.peer, evt.packet, std::chrono::steady_clock::now() };
+                    {
+                        std::lock_guard lock(m_jobMtx);
+                        if (ordered)
+                            m_orderedJobs.push_back(job);
+                        else
+                            m_jobs.push_back(job);
+                    }
+                    size_t depth = ++m_peerDepth[evt.peer];
+                    if (depth > m_maxPeerDepth)
+                        m_maxPeerDepth = depth;
+                    // Only the first worker takes ordered jobs, so wake everyone.
+                    if (ordered)
+                        m_jobCv.notify_all();
+                    else
+                        m_jobCv.notify_one();
                     break;
                 }
                 case ENET_EVENT_TYPE_DISCONNECT:
 
                     // Reset m_enetHost's information
+                    m_peers.erase(evt.peer);
+                    m_peerDepth.erase(evt.peer);
                     evt.peer->data = NULL;
                     break;
 
                 }
             }
-            else
-                break;
         }
     }
 
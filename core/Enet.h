@@ -3,15 +3,95 @@
 #include <thread>
 #include <future>
 #include <list>
+#include <set>
+#include <condition_variable>
+#include <atomic>
+#include "Stats.h"
 
 typedef struct _ENetHost ENetHost;
+typedef struct _ENetPacket ENetPacket;
+typedef struct _ENetPeer ENetPeer;
 namespace sam
 {
+    // Read only view over a contiguous array, stands in for std::span until
+    // the project moves past C++17.
+    template <class T> class span
+    {
+        const T* m_ptr;
+        size_t m_size;
+    public:
+        span() : m_ptr(nullptr), m_size(0) {}
+        span(const T* ptr, size_t size) : m_ptr(ptr), m_size(size) {}
+        const T* data() const { return m_ptr; }
+        size_t size() const { return m_size; }
+        bool empty() const { return m_size == 0; }
+        const T* begin() const { return m_ptr; }
+        const T* end() const { return m_ptr + m_size; }
+        const T& operator [] (size_t idx) const { return m_ptr[idx]; }
+    };
+
+    // Ref-counted, immutable byte range.  It either owns a received ENet
+    // packet or a heap string, and slices share the owner so a payload can
+    // move from the network thread to the tile loader without being copied.
+    class PacketBuffer
+    {
+        std::shared_ptr<const void> m_owner;
+        const char* m_data;
+        size_t m_size;
+        size_t m_ownerSize;
+    public:
+        PacketBuffer() : m_data(nullptr), m_size(0), m_ownerSize(0) {}
+        PacketBuffer(ENetPacket* packet, size_t offset, size_t size);
+        explicit PacketBuffer(std::string&& str)
+        {
+            auto owned = std::make_shared<const std::string>(std::move(str));
+            m_data = owned->data();
+            m_size = owned->size();
+            m_ownerSize = m_size;
+            m_owner = std::move(owned);
+        }
+
+        const char* data() const { return m_data; }
+        size_t size() const { return m_size; }
+        // Bytes kept alive by this buffer, the whole packet for a slice.
+        size_t ownerSize() const { return m_ownerSize; }
+
+        PacketBuffer Slice(size_t offset, size_t size) const
+        {
+            PacketBuffer buf;
+            buf.m_owner = m_owner;
+            buf.m_data = m_data + offset;
+            buf.m_size = size;
+            buf.m_ownerSize = m_ownerSize;
+            return buf;
+        }
+
+        // Copies the range out so it no longer holds on to its owner.
+        PacketBuffer Copy() const
+        {
+            if (m_size == 0)
+                return PacketBuffer();
+            return PacketBuffer(std::string(m_data, m_size));
+        }
+
+        // Payloads are written with 4 byte alignment.
+        template <class T> span<T> As() const
+        {
+            return span<T>((const T*)m_data, m_size / sizeof(T));
+        }
+    };
+
     struct ENetMsg
     {
         enum Type : int {
             GetLevelDbValue = 1,
-            SetLevelDbValue = 2
+            SetLevelDbValue = 2,
+            GetLevelDbValues = 3,
+            ScanLevelDbRegion = 4,
+            TileChanged = 5,
+            SetLevelDbValues = 6,
+            // Answered by ENetServer itself with a text dump of its stats.
+            GetStats = 7
         };
 
         struct Header
@@ -53,13 +133,17 @@ namespace sam
     struct ENetResponse
     {
         int status;
-        std::string data;
+        PacketBuffer data;
+        // Optional message the server pushes to every other connected peer.
+        std::shared_ptr<ENetMsg> notify;
     };
 
     struct ENetResponseHdr
     {
         size_t m_size;
         size_t m_uid;
+        // Uid of packets the server sends unprompted, message uids start at 100.
+        static const size_t NotifyUid = 0;
     };
 
     class ENetClient
@@ -81,6 +165,7 @@ namespace sam
         std::mutex m_queueLock;
         std::list<QueuedMsg> m_queuedMsg;
         std::unordered_map<uint64_t, QueuedMsg> m_waitingResponse;
+        std::function<void(const ENetMsg::Header* msg)> m_notifyFn;
         bool m_terminate;
     public:
         ~ENetClient();
@@ -91,25 +176,102 @@ namespace sam
 
         void Request(std::shared_ptr<ENetMsg> msg,
             const std::function<void(const ENetResponse& response)>& func);
+
+        // Called on the network thread for messages pushed by the server.
+        void OnNotify(const std::function<void(const ENetMsg::Header* msg)>& func);
     };
 
     class IServerHandler
     {
     public:
+        // Called concurrently from the server's worker threads.
         virtual ENetResponse HandleMessage(const ENetMsg::Header *msg) = 0;
+        // Messages that must be handled in the order they arrive, e.g. writes.
+        // These all run on a single worker.
+        virtual bool IsOrdered(const ENetMsg::Header* msg) const
+        { return false; }
+        // Appended to the server's own stats in GetStats responses.
+        virtual std::string GetStats() const
+        { return std::string(); }
     };
+
+    // The ENet thread only moves packets: received messages are queued for a
+    // pool of workers and their responses come back through a completion
+    // queue that the ENet thread drains and sends.  Workers wake the ENet
+    // thread from its socket wait when they queue a completion.
     class ENetServer
     {
+        struct Job
+        {
+            ENetPeer* peer;
+            ENetPacket* packet;
+            std::chrono::steady_clock::time_point received;
+        };
+
+        struct Completion
+        {
+            ENetPeer* peer;
+            ENetPacket* packet;
+            std::shared_ptr<ENetMsg> notify;
+        };
+
         std::string m_hostaddr;
         uint16_t m_port;
         std::thread m_thread;
         void BackgroundThread();
+        void WorkerThread(bool handlesOrdered);
+        void SendCompletions();
         ENetHost* m_enetHost;
         IServerHandler* m_svrHandler;        
+        std::set<ENetPeer*> m_peers;
+        void Notify(ENetPeer* sender, ENetMsg& msg);
+
+        size_t m_numWorkers;
+        std::vector<std::thread> m_workers;
+        mutable std::mutex m_jobMtx;
+        std::condition_variable m_jobCv;
+        std::list<Job> m_jobs;
+        std::list<Job> m_orderedJobs;
+        std::mutex m_completionMtx;
+        std::vector<Completion> m_completions;
+        std::atomic<bool> m_terminate;
+        // Loopback socket the workers send a byte to, waited on together
+        // with the host's socket.
+        struct Wakeup;
+        std::unique_ptr<Wakeup> m_wakeup;
+        void Wake();
+        void WaitForWork(uint32_t timeoutMs);
+
+        struct TypeStats
+        {
+            std::atomic<uint64_t> bytesIn{ 0 };
+            std::atomic<uint64_t> bytesOut{ 0 };
+            // Time from receiving a request to its response being ready.
+            LatencyHistogram latency;
+        };
+        mutable std::mutex m_statsMtx;
+        std::map<int, std::unique_ptr<TypeStats>> m_typeStats;
+        LatencyHistogram m_queueWait;
+        std::atomic<uint64_t> m_notifyBytes;
+        // Requests in flight per peer, only touched by the ENet thread.
+        std::map<ENetPeer*, size_t> m_peerDepth;
+        std::atomic<size_t> m_maxPeerDepth;
+        TypeStats& StatsFor(int type);
     public:
-        ENetServer(const std::string& m_hostaddr, uint16_t port, IServerHandler*);
+        // numWorkers of 0 uses one worker per hardware thread.
+        ENetServer(const std::string& m_hostaddr, uint16_t port, IServerHandler*, size_t numWorkers = 0);
         ~ENetServer();
         void Start();
+        // Only sets a flag, so it is safe to call from a signal handler.  The
+        // ENet thread notices it within one service timeout.
+        void RequestStop();
+        // Blocks until the ENet thread exits.
+        void Wait();
+        // Stops the ENet thread, lets the workers finish the requests already
+        // queued and sends their responses.
+        void Stop();
+        // Per message type latencies and traffic, followed by the handler's stats.
+        std::string GetStats() const;
     };
     
 }
\ No newline at end of file
@@ -9,8 +9,13 @@
 #include "leveldb/zlib_compressor.h"
 #include "leveldb/decompress_allocator.h"
 #include "leveldb/db.h"
+#include "leveldb/iterator.h"
+#include "leveldb/write_batch.h"
 #include "Enet.h"
+#include "ChunkCache.h"
+#include "PartChunk.h"
 #include <thread>
+#include <algorithm>
 
 
 namespace sam
@@ -25,10 +30,19 @@ namespace sam
 
     LevelSvr::LevelSvr(bool disableWrite) :
         m_disableWrite(disableWrite),
-        m_db(nullptr)
+        m_db(nullptr),
+        m_writeGen(0),
+        m_dbHits(0),
+        m_dbMisses(0),
+        m_slowestGetMicros(0)
     {
     }
 
+    LevelSvr::~LevelSvr()
+    {
+        CloseDb();
+    }
+
 
     void LevelSvr::OpenDb(const std::string& path)
     {
@@ -57,6 +71,13 @@ namespace sam
         leveldb::Status status = leveldb::DB::Open(options, path.c_str(), &m_db);
     }
 
+    void LevelSvr::CloseDb()
+    {
+        std::lock_guard lock(m_writeMtx);
+        delete m_db;
+        m_db = nullptr;
+    }
+
 
 
     bool LevelSvr::AutoGenerateTile(const ILevel::OctKey& k, std::string* val) const
@@ -73,24 +94,101 @@ namespace sam
             pi.connected = true;
             pi.canBeDestroyed = false;
             parts.push_back(pi);
-            val->resize(parts.size() *
-                sizeof(PartInst));
-            memcpy(val->data(), (const char*)parts.data(), parts.size() *
-                sizeof(PartInst));
+            PartChunk::Encode(parts, val);
             return true;
         }
         return false;
     }
 
+    bool LevelSvr::IsPartChunkKey(const ILevel::OctKey& k)
+    {
+        return k.Type() == 0;
+    }
+
+    bool LevelSvr::IsAggregateKey(const ILevel::OctKey& k)
+    {
+        return k.Type() == 0 && k.Level() >= AggregateLevel && k.Level() < LeafLevel;
+    }
+
+    std::string LevelSvr::DbKey(const std::string& k)
+    {
+        // Tile keys arrive as raw OctKey structs and are stored Morton encoded.
+        if (k.length() == sizeof(ILevel::OctKey))
+            return ((const ILevel::OctKey*)k.data())->ToDbKey();
+        return k;
+    }
+
+    bool LevelSvr::BuildAggregateTile(const ILevel::OctKey& k, std::string* val) const
+    {
+        ScopedLatency timer(m_aggregateLatency);
+        uint64_t writeGen = m_writeGen;
+        Loc l = k.GetLoc();
+        Point3f parentCenter = l.GetCenter();
+        std::vector<PartInst> parts;
+        std::vector<PartInst> childParts;
+        for (const Loc& cl : l.GetChildren())
+        {
+            ILevel::OctKey ck(cl, 0);
+            std::string childVal;
+            if (!ReadValue(std::string((const char*)&ck, sizeof(ck)), &childVal) ||
+                !PartChunk::Decode(childVal.data(), childVal.size(), &childParts))
+                continue;
+            size_t offset = parts.size();
+            parts.insert(parts.end(), childParts.begin(), childParts.end());
+            Point3f childCenter = cl.GetCenter();
+            for (size_t idx = offset; idx < parts.size(); ++idx)
+            {
+                parts[idx].pos = (parts[idx].pos + childCenter) - parentCenter;
+            }
+        }
+
+        PartChunk::Encode(parts, val);
+        // Store the result (even if empty) so the merge only runs again after
+        // a write below this tile invalidates it.
+        if (!m_disableWrite)
+        {
+            std::lock_guard lock(m_writeMtx);
+            if (writeGen == m_writeGen)
+                m_db->Put(leveldb::WriteOptions(), k.ToDbKey(), leveldb::Slice(*val));
+        }
+        return true;
+    }
+
     bool LevelSvr::GetValue(const std::string& k, std::string* val) const
+    {
+        auto start = std::chrono::steady_clock::now();
+        bool result = ReadValue(k, val);
+        RecordGet(k, ScopedLatency::MicrosSince(start));
+        return result;
+    }
+
+    void LevelSvr::RecordGet(const std::string& k, double micros) const
+    {
+        m_getLatency.Add(micros);
+        if (k.length() != sizeof(ILevel::OctKey) || micros <= m_slowestGetMicros)
+            return;
+        std::lock_guard lock(m_statsMtx);
+        if (micros > m_slowestGetMicros)
+        {
+            m_slowestGetMicros = micros;
+            m_slowestGetKey = *(const ILevel::OctKey*)k.data();
+        }
+    }
+
+    bool LevelSvr::ReadValue(const std::string& k, std::string* val) const
     {
         if (k.length() == sizeof(ILevel::OctKey))
         {
             ILevel::OctKey* octkey = (ILevel::OctKey*)k.data();
-            leveldb::Slice key(k);
-            leveldb::Status status = m_db->Get(leveldb::ReadOptions(), key, val);
+            leveldb::Status status = m_db->Get(leveldb::ReadOptions(), octkey->ToDbKey(), val);
             if (status.ok())
+            {
+                m_dbHits++;
                 return true;
+            }
+            m_dbMisses++;
+            if (IsAggregateKey(*octkey))
+                return BuildAggregateTile(*octkey, val);
             else
                 return AutoGenerateTile(*octkey, val);
         }
@@ -102,16 +200,218 @@ namespace sam
         }
     }
 
+    void LevelSvr::GetValues(const std::vector<std::string>& keys, std::vector<std::string>* vals) const
+    {
+        vals->resize(keys.size());
+        std::vector<std::string> dbKeys(keys.size());
+        for (size_t idx = 0; idx < keys.size(); ++idx)
+            dbKeys[idx] = DbKey(keys[idx]);
+        // Visit the keys in sorted order so one iterator walks forward through
+        // the table instead of doing an independent Get per key.
+        std::vector<size_t> order(keys.size());
+        for (size_t idx = 0; idx < order.size(); ++idx)
+            order[idx] = idx;
+        std::sort(order.begin(), order.end(), [&dbKeys](size_t a, size_t b)
+            { return dbKeys[a] < dbKeys[b]; });
+
+        std::unique_ptr<leveldb::Iterator> it(m_db->NewIterator(leveldb::ReadOptions()));
+        for (size_t idx : order)
+        {
+            auto start = std::chrono::steady_clock::now();
+            const std::string& k = keys[idx];
+            const std::string& dbKey = dbKeys[idx];
+            std::string* val = &(*vals)[idx];
+            it->Seek(leveldb::Slice(dbKey));
+            if (it->Valid() && it->key() == leveldb::Slice(dbKey))
+            {
+                m_dbHits++;
+                leveldb::Slice v = it->value();
+                val->assign(v.data(), v.size());
+            }
+            else if (k.length() == sizeof(ILevel::OctKey))
+            {
+                m_dbMisses++;
+                const ILevel::OctKey* octkey = (const ILevel::OctKey*)k.data();
+                bool result = IsAggregateKey(*octkey) ?
+                    BuildAggregateTile(*octkey, val) :
+                    AutoGenerateTile(*octkey, val);
+                if (!result)
+                    val->clear();
+            }
+            RecordGet(k, ScopedLatency::MicrosSince(start));
+        }
+    }
+
+    void LevelSvr::AddWrite(leveldb::WriteBatch& batch, const std::string& k, const char* byte, size_t len)
+    {
+        if (k.length() != sizeof(ILevel::OctKey))
+        {
+            batch.Put(DbKey(k), leveldb::Slice(byte, len));
+            return;
+        }
+        const ILevel::OctKey* octkey = (const ILevel::OctKey*)k.data();
+        std::vector<PartInst> parts;
+        std::string encoded;
+        // Older clients send raw PartInst arrays, store those encoded too.
+        if (IsPartChunkKey(*octkey) && !PartChunk::IsEncoded(byte, len) &&
+            PartChunk::Decode(byte, len, &parts))
+        {
+            PartChunk::Encode(parts, &encoded);
+            batch.Put(DbKey(k), leveldb::Slice(encoded));
+        }
+        else
+            batch.Put(DbKey(k), leveldb::Slice(byte, len));
+
+        // Drop the aggregated parents in the same batch, they get rebuilt
+        // from their children the next time they are read.
+        Loc l = octkey->GetLoc();
+        if (octkey->Type() == 0 && l.m_l == LeafLevel)
+        {
+            for (int level = LeafLevel - 1; level >= AggregateLevel; --level)
+            {
+                ILevel::OctKey pk(l.ParentAtLevel(level), 0);
+                batch.Delete(pk.ToDbKey());
+            }
+        }
+    }
+
     bool LevelSvr::WriteValue(const std::string& k, const char* byte, size_t len)
     {
         if (m_disableWrite)
             return true;
-        leveldb::Slice key(k);
-        leveldb::Slice val(byte, len);
-        leveldb::Status status = m_db->Put(leveldb::WriteOptions(), key, val);
+        ScopedLatency timer(m_writeLatency);
+        leveldb::WriteBatch batch;
+        AddWrite(batch, k, byte, len);
+        std::lock_guard lock(m_writeMtx);
+        leveldb::Status status = m_db->Write(leveldb::WriteOptions(), &batch);
+        m_writeGen++;
+        return status.ok();
+    }
+
+    bool LevelSvr::WriteValues(const std::vector<std::pair<std::string, std::string>>& keyvals)
+    {
+        if (m_disableWrite)
+            return true;
+        ScopedLatency timer(m_writeLatency);
+        leveldb::WriteBatch batch;
+        for (const auto& kv : keyvals)
+        {
+            AddWrite(batch, kv.first, kv.second.data(), kv.second.size());
+        }
+        std::lock_guard lock(m_writeMtx);
+        leveldb::Status status = m_db->Write(leveldb::WriteOptions(), &batch);
+        m_writeGen++;
         return status.ok();
     }
 
+    bool LevelSvr::ScanRegion(const Loc& parent, int level,
+        const std::function<void(const Loc&, const std::string&)>& fn) const
+    {
+        int ldelta = level - parent.m_l;
+        if (ldelta < 0)
+            return false;
+        // Every descendant of parent at this level sits in one Morton range,
+        // so a single seek and a forward walk visits exactly the region.
+        uint64_t first = parent.GetMortonCode() << (3 * ldelta);
+        uint64_t last = first + (1ull << (3 * ldelta));
+        std::string startKey = ILevel::OctKey::EncodeDbKey(0, level, first, 0);
+        std::string endKey = ILevel::OctKey::EncodeDbKey(0, level, last, 0);
+
+        std::unique_ptr<leveldb::Iterator> it(m_db->NewIterator(leveldb::ReadOptions()));
+        for (it->Seek(startKey); it->Valid() && it->key().compare(endKey) < 0; it->Next())
+        {
+            ILevel::OctKey key;
+            if (!ILevel::OctKey::FromDbKey(it->key().data(), it->key().size(), key))
+                continue;
+            std::string val(it->value().data(), it->value().size());
+            fn(key.GetLoc(), val);
+        }
+        return it->status().ok();
+    }
+
+    size_t LevelSvr::MigrateOctKeys()
+    {
+        const size_t batchSize = 1024;
+        size_t converted = 0;
+        leveldb::WriteBatch batch;
+        size_t batchCt = 0;
+        std::unique_ptr<leveldb::Iterator> it(m_db->NewIterator(leveldb::ReadOptions()));
+        for (it->SeekToFirst(); it->Valid(); it->Next())
+        {
+            ILevel::OctKey octkey;
+            bool rawKey = it->key().size() == sizeof(ILevel::OctKey);
+            if (rawKey)
+                memcpy(&octkey, it->key().data(), sizeof(octkey));
+            else if (!ILevel::OctKey::FromDbKey(it->key().data(), it->key().size(), octkey))
+                continue;
+            leveldb::Slice value = it->value();
+            bool rawChunk = IsPartChunkKey(octkey) && !PartChunk::IsEncoded(value.data(), value.size());
+            if (!rawKey && !rawChunk)
+                continue;
+            std::vector<PartInst> parts;
+            std::string encoded;
+            if (rawChunk && PartChunk::Decode(value.data(), value.size(), &parts))
+            {
+                PartChunk::Encode(parts, &encoded);
+                value = leveldb::Slice(encoded);
+            }
+            else if (!rawKey)
+                continue;
+            batch.Put(octkey.ToDbKey(), value);
+            if (rawKey)
+                batch.Delete(it->key());
+            converted++;
+            if (++batchCt == batchSize)
+            {
+                m_db->Write(leveldb::WriteOptions(), &batch);
+                batch.Clear();
+                batchCt = 0;
+            }
+        }
+        if (batchCt > 0)
+            m_db->Write(leveldb::WriteOptions(), &batch);
+        return converted;
+    }
+
+    std::string LevelSvr::GetStats() const
+    {
+        std::ostringstream ss;
+        uint64_t hits = m_dbHits, misses = m_dbMisses;
+        ss << "== Level ==" << std::endl;
+        ss << "db hits: " << hits << " misses: " << misses;
+        if (hits + misses > 0)
+            ss << " (" << (100.0 * hits / (hits + misses)) << "% hit)";
+        ss << std::endl;
+        {
+            std::lock_guard lock(m_statsMtx);
+            if (m_slowestGetMicros > 0)
+            {
+                Loc l = m_slowestGetKey.GetLoc();
+                ss << "slowest tile: [" << l.m_x << "," << l.m_y << "," << l.m_z << "," << l.m_l
+                    << "] type " << (int)m_slowestGetKey.Type() << " " << m_slowestGetMicros.load() << "us" << std::endl;
+            }
+        }
+        ss << "-- GetValue (us) --" << std::endl << m_getLatency.ToString();
+        ss << "-- WriteValue (us) --" << std::endl << m_writeLatency.ToString();
+        ss << "-- BuildAggregateTile (us) --" << std::endl << m_aggregateLatency.ToString();
+        if (m_db != nullptr)
+        {
+            for (const char* prop : { "leveldb.stats", "leveldb.sstables", "leveldb.approximate-memory-usage" })
+            {
+                std::string val;
+                if (m_db->GetProperty(prop, &val))
+                    ss << "-- " << prop << " --" << std::endl << val << std::endl;
+            }
+        }
+        return ss.str();
+    }
+
+    bool LevelSvr::IsOrdered(const ENetMsg::Header* msg) const
+    {
+        return msg->m_type == ENetMsg::Type::SetLevelDbValue ||
+            msg->m_type == ENetMsg::Type::SetLevelDbValues;
+    }
+
     ENetResponse LevelSvr::HandleMessage(const ENetMsg::Header* msg)
     {
         ENetResponse response;
@@ -120,8 +420,29 @@ namespace sam
             GetLevelValueMsg gmsg;
             gmsg.ReadData((const uint8_t*)msg);
             std::string val;
-            bool result = GetValue(gmsg.m_key, &response.data);
-            if (!result) response.data = std::string();
+            bool result = GetValue(gmsg.m_key, &val);
+            if (result) response.data = PacketBuffer(std::move(val));
+        }
+        else if (msg->m_type == ENetMsg::GetLevelDbValues)
+        {
+            GetLevelValuesMsg gmsg;
+            gmsg.ReadData((const uint8_t*)msg);
+            std::vector<std::string> vals;
+            GetValues(gmsg.m_keys, &vals);
+            std::string val;
+            GetLevelValuesMsg::WriteValues(vals, &val);
+            response.data = PacketBuffer(std::move(val));
+        }
+        else if (msg->m_type == ENetMsg::ScanLevelDbRegion)
+        {
+            ScanLevelRegionMsg gmsg;
+            gmsg.ReadData((const uint8_t*)msg);
+            std::string vals;
+            ScanRegion(gmsg.m_parent, gmsg.m_level, [&vals](const Loc& l, const std::string& val)
+                {
+                    ScanLevelRegionMsg::AppendValue(l, val, &vals);
+                });
+            response.data = PacketBuffer(std::move(vals));
         }
         else if (msg->m_type == ENetMsg::SetLevelDbValue)
         {
@@ -129,21 +450,113 @@ namespace sam
             gmsg.ReadData((const uint8_t*)msg);
             Loc tileLoc;
             memcpy(&tileLoc, gmsg.m_key.data(), gmsg.m_key.size());
-            std::string val;
             bool result = WriteValue(gmsg.m_key, gmsg.m_data.data(), gmsg.m_data.size());
-            if (!result) response.data = std::string();
+            if (result && gmsg.m_key.size() == sizeof(ILevel::OctKey))
+            {
+                // Let other clients drop their cached copy of this tile.
+                ILevel::OctKey octkey;
+                memcpy(&octkey, gmsg.m_key.data(), sizeof(octkey));
+                response.notify = std::make_shared<TileChangedMsg>(
+                    std::vector<ILevel::OctKey>{ octkey });
+            }
+        }
+        else if (msg->m_type == ENetMsg::SetLevelDbValues)
+        {
+            SetLevelValuesMsg gmsg;
+            gmsg.ReadData((const uint8_t*)msg);
+            bool result = WriteValues(gmsg.m_keyvals);
+            response.data = PacketBuffer(std::string(1, result ? 1 : 0));
+            std::vector<ILevel::OctKey> changed;
+            for (const auto& kv : gmsg.m_keyvals)
+            {
+                if (kv.first.size() != sizeof(ILevel::OctKey))
+                    continue;
+                ILevel::OctKey octkey;
+                memcpy(&octkey, kv.first.data(), sizeof(octkey));
+                changed.push_back(octkey);
+            }
+            if (result && changed.size() > 0)
+                response.notify = std::make_shared<TileChangedMsg>(changed);
 
         }
         return response;
     }
 
-    LevelCli::LevelCli()
+    LevelCli::LevelCli(size_t cacheBudget) :
+        m_cache(std::make_unique<ChunkCache>(cacheBudget)),
+        m_prefetchRequested(0),
+        m_prefetchUsed(0),
+        m_exit(false),
+        m_flushesInFlight(0),
+        m_changedOverflow(false)
     {
 
     }
+
+    LevelCli::~LevelCli()
+    {
+        {
+            std::lock_guard lock(m_writeMtx);
+            m_exit = true;
+        }
+        m_writeCv.notify_one();
+        if (m_writeThread.joinable())
+            m_writeThread.join();
+        std::unique_lock<std::mutex> lk(m_writeMtx);
+        m_writeCv.wait(lk, [this]() { return m_flushesInFlight == 0; });
+    }
+
     void LevelCli::Connect(ENetClient* cli)
     {
         m_client = cli;
+        std::thread t1(std::bind(&LevelCli::WriteThread, this));
+        m_writeThread.swap(t1);
+        m_client->OnNotify([this](const ENetMsg::Header* msg)
+            {
+                if (msg->m_type == ENetMsg::TileChanged)
+                {
+                    TileChangedMsg tmsg;
+                    tmsg.ReadData((const uint8_t*)msg);
+                    for (const OctKey& key : tmsg.m_keys)
+                    {
+                        Invalidate(key);
+                        InvalidateParents(key.GetLoc());
+                    }
+                    std::lock_guard lock(m_changedMtx);
+                    if (m_changedKeys.size() + tmsg.m_keys.size() > MaxChangedKeys)
+                    {
+                        m_changedKeys.clear();
+                        m_changedOverflow = true;
+                    }
+                    else
+                        m_changedKeys.insert(m_changedKeys.end(), tmsg.m_keys.begin(), tmsg.m_keys.end());
+                }
+            });
+    }
+
+    bool LevelCli::TakeChangedKeys(std::vector<OctKey>* keys)
+    {
+        std::lock_guard lock(m_changedMtx);
+        keys->clear();
+        std::swap(*keys, m_changedKeys);
+        bool complete = !m_changedOverflow;
+        m_changedOverflow = false;
+        return complete;
+    }
+
+    void LevelCli::Invalidate(const OctKey& key)
+    {
+        MarkStale(key);
+        m_cache->Invalidate(key);
+    }
+
+    void LevelCli::InvalidateParents(const Loc& l)
+    {
+        // Coarse tiles are aggregated from their children on the server.
+        for (int level = l.m_l - 1; level >= 0; --level)
+        {
+            Invalidate(OctKey(l.ParentAtLevel(level), 0));
+        }
     }
 
     template<typename R>
@@ -151,29 +564,132 @@ namespace sam
     {
         return f.wait_for(std::chrono::seconds(0)) == std::future_status::ready;
     }
-    bool LevelCli::GetOctChunk(const ILevel::OctKey& l, std::string* val) const
+    void LevelCli::CompletePrefetch() const
+    {
+        std::lock_guard lock(m_prefetchMtx);
+        if (m_prefetch == nullptr || !is_ready(m_prefetch->future))
+            return;
+        ENetResponse resp = m_prefetch->future.get();
+        std::vector<PacketBuffer> vals;
+        if (GetLevelValuesMsg::ReadValues(resp.data, m_prefetch->keys.size(), &vals))
+        {
+            // Forget unused keys rather than grow without bound.
+            if (m_prefetched.size() + vals.size() > MaxPrefetchedKeys)
+                m_prefetched.clear();
+            for (size_t idx = 0; idx < vals.size(); ++idx)
+            {
+                const OctKey& key = m_prefetch->keys[idx];
+                if (CacheRead(&m_prefetch->read, key, vals[idx]))
+                    m_prefetched.insert(key);
+            }
+        }
+        EndRead(&m_prefetch->read);
+        m_prefetch = nullptr;
+    }
+
+    void LevelCli::BeginRead(PendingRead* read) const
+    {
+        std::lock_guard lock(m_readMtx);
+        m_reads.push_back(read);
+    }
+
+    bool LevelCli::CacheRead(PendingRead* read, const OctKey& key, const PacketBuffer& val) const
+    {
+        // Held across Add so a key is either marked first or has its
+        // entry replaced or invalidated after.
+        std::lock_guard lock(m_readMtx);
+        if (read->stale.find(key) != read->stale.end())
+            return false;
+        return m_cache->Add(key, val);
+    }
+
+    void LevelCli::EndRead(PendingRead* read) const
     {
+        std::lock_guard lock(m_readMtx);
+        m_reads.erase(std::remove(m_reads.begin(), m_reads.end(), read), m_reads.end());
+    }
+
+    void LevelCli::MarkStale(const OctKey& key)
+    {
+        std::lock_guard lock(m_readMtx);
+        for (PendingRead* read : m_reads)
+            read->stale.insert(key);
+    }
 
-        auto itCache = m_cache.find(l);
-        if (itCache != m_cache.end())
+    void LevelCli::NoteCacheHit(const OctKey& key) const
+    {
+        std::lock_guard lock(m_prefetchMtx);
+        if (m_prefetched.erase(key) > 0)
+            m_prefetchUsed++;
+    }
+
+    void LevelCli::Prefetch(const std::vector<OctKey>& keys)
+    {
+        CompletePrefetch();
+        std::unique_ptr<PrefetchBatch> batch = std::make_unique<PrefetchBatch>();
+        std::vector<std::string> msgKeys;
         {
-            *val = itCache->second;
+            std::lock_guard requestLock(m_requestMtx);
+            std::lock_guard lock(m_prefetchMtx);
+            if (m_prefetch != nullptr)
+                return;
+            for (const OctKey& key : keys)
+            {
+                if (batch->keys.size() >= MaxPrefetchKeys)
+                    break;
+                if (m_requests.find(key) != m_requests.end() ||
+                    m_prefetched.find(key) != m_prefetched.end() ||
+                    m_cache->Contains(key))
+                    continue;
+                batch->keys.push_back(key);
+                msgKeys.push_back(std::string((const char*)&key, sizeof(OctKey)));
+            }
+            if (batch->keys.size() == 0)
+                return;
+            BeginRead(&batch->read);
+            batch->future = m_client->Send(std::make_shared<GetLevelValuesMsg>(msgKeys));
+            m_prefetchRequested += batch->keys.size();
+            m_prefetch = std::move(batch);
+        }
+    }
+
+    ILevel::PrefetchStats LevelCli::GetPrefetchStats() const
+    {
+        return PrefetchStats{ m_prefetchRequested, m_prefetchUsed };
+    }
+
+    bool LevelCli::GetOctChunk(const ILevel::OctKey& l, PacketBuffer* val) const
+    {
+        CompletePrefetch();
+        if (m_cache->Get(l, val))
+        {
+            NoteCacheHit(l);
             return true;
         }
 
+        // Called from several loader threads.
+        std::lock_guard lock(m_requestMtx);
         int itemReady = 0;
         for (auto itCheck = m_requests.begin(); itCheck != m_requests.end();)
         {
-            if (is_ready(itCheck->second))
+            if (is_ready(itCheck->second.future))
             {
-                ENetResponse resp = itCheck->second.get();
-                *val = resp.data;
+                ENetResponse resp = itCheck->second.future.get();
+                bool cached = CacheRead(&itCheck->second.read, itCheck->first, resp.data);
                 if (itCheck->first == l)
-                    itemReady = 1;
-                m_cache.insert(std::make_pair(itCheck->first, resp.data));
+                {
+                    // If it went stale, return the newer cache entry, or
+                    // fetch again below when it was invalidated.
+                    if (cached)
+                    {
+                        itemReady = 1;
+                        *val = resp.data;
+                    }
+                    else if (m_cache->Get(l, val))
+                        itemReady = 1;
+                }
+                EndRead(&itCheck->second.read);
                 itCheck = m_requests.erase(itCheck);
-                *val = resp.data;
-
             }
             else
             {
@@ -191,19 +707,151 @@ namespace sam
         auto itRequest = m_requests.find(l);
         if (itRequest == m_requests.end())
         {
-            std::future<ENetResponse> future = m_client->Send(std::make_shared<GetLevelValueMsg>((const uint8_t*)&l, sizeof(l)));
-            itRequest =
-                m_requests.insert(std::move(std::make_pair(l,
-                    std::move(future)))).first;
+            itRequest = m_requests.emplace(l, ChunkRequest()).first;
+            BeginRead(&itRequest->second.read);
+            itRequest->second.future = m_client->Send(std::make_shared<GetLevelValueMsg>((const uint8_t*)&l, sizeof(l)));
         }
 
         return false;
     }
-    bool LevelCli::WriteOctChunk(const ILevel::OctKey& l, const char* byte, size_t len)
+
+    bool LevelCli::GetOctChunks(const std::vector<OctKey>& keys, std::vector<PacketBuffer>* vals) const
     {
-        auto future = m_client->Send(std::make_shared<SetLevelValueMsg>((const uint8_t*)&l, sizeof(l), byte, len));
+        CompletePrefetch();
+        vals->resize(keys.size());
+        std::vector<size_t> missing;
+        std::vector<std::string> missingKeys;
+        for (size_t idx = 0; idx < keys.size(); ++idx)
+        {
+            if (!m_cache->Get(keys[idx], &(*vals)[idx]))
+            {
+                missing.push_back(idx);
+                missingKeys.push_back(std::string((const char*)&keys[idx], sizeof(OctKey)));
+            }
+            else
+                NoteCacheHit(keys[idx]);
+        }
+
+        if (missing.size() == 0)
+            return true;
+
+        PendingRead read;
+        BeginRead(&read);
+        auto future = m_client->Send(std::make_shared<GetLevelValuesMsg>(missingKeys));
         ENetResponse resp = future.get();
-        return resp.status == 1;
+        std::vector<PacketBuffer> missingVals;
+        if (!GetLevelValuesMsg::ReadValues(resp.data, missing.size(), &missingVals))
+        {
+            EndRead(&read);
+            return false;
+        }
+
+        for (size_t idx = 0; idx < missing.size(); ++idx)
+        {
+            const OctKey& key = keys[missing[idx]];
+            // A stale result is still returned when the key was only
+            // invalidated, it's the newest the server had for us.
+            if (CacheRead(&read, key, missingVals[idx]) ||
+                !m_cache->Get(key, &(*vals)[missing[idx]]))
+                (*vals)[missing[idx]] = missingVals[idx];
+        }
+        EndRead(&read);
+        return true;
+    }
+
+    bool LevelCli::ScanRegion(const Loc& parent, int level,
+        const std::function<void(const Loc&, const PacketBuffer&)>& fn) const
+    {
+        PendingRead read;
+        BeginRead(&read);
+        auto future = m_client->Send(std::make_shared<ScanLevelRegionMsg>(parent, level));
+        ENetResponse resp = future.get();
+        bool result = ScanLevelRegionMsg::ReadValues(resp.data, [this, &fn, &read](const Loc& l, PacketBuffer&& val)
+            {
+                fn(l, val);
+                CacheRead(&read, OctKey(l, 0), val);
+            });
+        EndRead(&read);
+        return result;
+    }
+
+    bool LevelCli::WriteOctChunk(const ILevel::OctKey& l, const char* byte, size_t len,
+        const std::function<void(bool)>& onComplete)
+    {
+        // Write through so our own reads see the new tile right away.
+        MarkStale(l);
+        m_cache->Put(l, PacketBuffer(std::string(byte, len)));
+        InvalidateParents(l.GetLoc());
+        {
+            std::lock_guard lock(m_writeMtx);
+            if (m_pendingWrites.size() == 0)
+                m_firstPendingWrite = std::chrono::steady_clock::now();
+            PendingWrite& pw = m_pendingWrites[l];
+            pw.data.assign(byte, len);
+            if (onComplete != nullptr)
+                pw.callbacks.push_back(onComplete);
+        }
+        m_writeCv.notify_one();
+        return true;
+    }
+
+    void LevelCli::WriteThread()
+    {
+        std::unique_lock<std::mutex> lk(m_writeMtx);
+        while (true)
+        {
+            m_writeCv.wait(lk, [this]() { return m_exit || m_pendingWrites.size() > 0; });
+            if (!m_exit)
+            {
+                m_writeCv.wait_until(lk, m_firstPendingWrite + WriteWindow,
+                    [this]() { return m_exit; });
+            }
+            std::map<OctKey, PendingWrite> writes;
+            std::swap(writes, m_pendingWrites);
+            bool exit = m_exit;
+            lk.unlock();
+            FlushWrites(writes);
+            lk.lock();
+            if (exit)
+                break;
+        }
+    }
+
+    void LevelCli::FlushWrites(std::map<OctKey, PendingWrite>& writes)
+    {
+        if (writes.size() == 0)
+            return;
+        std::vector<std::pair<std::string, std::string>> keyvals;
+        auto callbacks = std::make_shared<std::vector<std::function<void(bool)>>>();
+        auto written = std::make_shared<std::vector<Loc>>();
+        for (auto& pair : writes)
+        {
+            written->push_back(pair.first.GetLoc());
+            keyvals.push_back(std::make_pair(
+                std::string((const char*)&pair.first, sizeof(OctKey)),
+                std::move(pair.second.data)));
+            for (auto& cb : pair.second.callbacks)
+                callbacks->push_back(std::move(cb));
+        }
+        {
+            std::lock_guard lock(m_writeMtx);
+            m_flushesInFlight++;
+        }
+        m_client->Request(std::make_shared<SetLevelValuesMsg>(std::move(keyvals)),
+            [this, callbacks, written](const ENetResponse& response)
+            {
+                // A coarse tile read while the write was in flight may have
+                // cached an aggregate of the old children, and the server
+                // doesn't send us TileChanged for our own writes.
+                for (const Loc& l : *written)
+                    InvalidateParents(l);
+                bool result = response.data.size() == 1 && response.data.data()[0] == 1;
+                for (auto& cb : *callbacks)
+                    cb(result);
+                std::lock_guard lock(m_writeMtx);
+                if (--m_flushesInFlight == 0)
+                    m_writeCv.notify_all();
+            });
     }
 
     bool LevelCli::WritePlayerData(const PlayerData& pos)
@@ -4,19 +4,25 @@
 #include <map>
 #include <set>
 #include <functional>
+#include <thread>
+#include <condition_variable>
+#include <unordered_set>
 #include "Loc.h"
 #include "PartDefs.h"
 #include "Enet.h"
 #include "dbl_list.h"
+#include "Stats.h"
 
 namespace leveldb
 {
     class DB;
+    class WriteBatch;
 }
 
 namespace sam
 {
     class ENetClient;
+    class ChunkCache;
     class ILevel {
     public:
         struct PlayerData
@@ -43,11 +49,53 @@ namespace sam
             {
 
             }
+            OctKey() {}
             int x;
             int y;
             int z;
             int l;
 
+            int Level() const { return l & 0xFF; }
+            int Type() const { return (l >> 8) & 0xFF; }
+            uint16_t MetaData() const { return (l >> 16) & 0xFFFF; }
+            Loc GetLoc() const { return Loc(x, y, z, Level()); }
+
+            // On-disk key: tag, type, level, Morton code and metadata, all big
+            // endian so leveldb's bytewise order keeps nearby tiles together.
+            static const size_t DbKeySize = 13;
+            static const char DbKeyTag = 'o';
+
+            static std::string EncodeDbKey(int type, int level, uint64_t morton, uint16_t mdata)
+            {
+                std::string key(DbKeySize, 0);
+                key[0] = DbKeyTag;
+                key[1] = (char)type;
+                key[2] = (char)level;
+                for (int i = 0; i < 8; ++i)
+                    key[3 + i] = (char)((morton >> (56 - i * 8)) & 0xFF);
+                key[11] = (char)(mdata >> 8);
+                key[12] = (char)(mdata & 0xFF);
+                return key;
+            }
+
+            std::string ToDbKey() const
+            {
+                return EncodeDbKey(Type(), Level(), GetLoc().GetMortonCode(), MetaData());
+            }
+
+            static bool FromDbKey(const char* data, size_t len, OctKey& key)
+            {
+                if (len != DbKeySize || data[0] != DbKeyTag)
+                    return false;
+                const uint8_t* b = (const uint8_t*)data;
+                uint64_t morton = 0;
+                for (int i = 0; i < 8; ++i)
+                    morton = (morton << 8) | b[3 + i];
+                uint16_t mdata = (b[11] << 8) | b[12];
+                key = OctKey(Loc::FromMortonCode(morton, b[2]), b[1], mdata);
+                return true;
+            }
+
             bool operator == (const OctKey& other) const
             {
                 return x == other.x &&
@@ -66,42 +114,199 @@ namespace sam
                     return y < rhs.y;
                 return z < rhs.z;
             }
+
+            struct Hash
+            {
+                size_t operator()(const OctKey& k) const
+                {
+                    uint64_t h = (uint64_t)(uint32_t)k.x * 73856093ull;
+                    h ^= (uint64_t)(uint32_t)k.y * 19349663ull;
+                    h ^= (uint64_t)(uint32_t)k.z * 83492791ull;
+                    h ^= (uint64_t)(uint32_t)k.l * 2654435761ull;
+                    return (size_t)(h ^ (h >> 32));
+                }
+            };
         };
 
-        virtual bool GetOctChunk(const OctKey &, std::string* val) const = 0;
-        virtual bool WriteOctChunk(const OctKey &, const char* byte, size_t len) = 0;
+        virtual bool GetOctChunk(const OctKey &, PacketBuffer* val) const = 0;
+        // Fetches all keys in one request.  vals is resized to match keys,
+        // missing chunks come back as empty buffers.
+        virtual bool GetOctChunks(const std::vector<OctKey>& keys, std::vector<PacketBuffer>* vals) const = 0;
+        // Calls fn for every stored chunk at level that lies inside parent.
+        virtual bool ScanRegion(const Loc& parent, int level,
+            const std::function<void(const Loc&, const PacketBuffer&)>& fn) const = 0;
+        // Queues the write and returns immediately.  onComplete is called with
+        // the server's result once the write has been applied.
+        virtual bool WriteOctChunk(const OctKey &, const char* byte, size_t len,
+            const std::function<void(bool)>& onComplete = nullptr) = 0;
         virtual bool WritePlayerData(const PlayerData& pos) = 0;
         virtual bool GetPlayerData(PlayerData& pos) = 0;
+
+        struct PrefetchStats
+        {
+            uint64_t requested;
+            // Prefetched chunks that were later fetched from the cache.
+            uint64_t used;
+        };
+        // Fetches keys into the client cache in the background, at lower
+        // priority than GetOctChunk.  Keys may be dropped.
+        virtual void Prefetch(const std::vector<OctKey>& keys) = 0;
+        virtual PrefetchStats GetPrefetchStats() const = 0;
+        // Keys other clients changed since the last call.  Returns false if
+        // there were too many to keep, then treat every tile as changed.
+        virtual bool TakeChangedKeys(std::vector<OctKey>* keys) = 0;
     };
 
     class LevelSvr : public IServerHandler {
         leveldb::DB* m_db;
         bool m_disableWrite;
+        // Requests are handled on several threads.  Writes bump m_writeGen
+        // under m_writeMtx so an aggregate tile built from children that have
+        // since changed is not stored back over the write's delete.
+        mutable std::mutex m_writeMtx;
+        std::atomic<uint64_t> m_writeGen;
+
+        mutable LatencyHistogram m_getLatency;
+        mutable LatencyHistogram m_writeLatency;
+        mutable LatencyHistogram m_aggregateLatency;
+        mutable std::atomic<uint64_t> m_dbHits;
+        mutable std::atomic<uint64_t> m_dbMisses;
+        mutable std::mutex m_statsMtx;
+        mutable std::atomic<double> m_slowestGetMicros;
+        mutable ILevel::OctKey m_slowestGetKey;
+
+        // Tiles at LeafLevel hold the actual parts.  Tiles from AggregateLevel
+        // up to LeafLevel - 1 are merged from their children on the server and
+        // stored back in the db so clients fetch a coarse tile with one key.
+        static const int LeafLevel = 8;
+        static const int AggregateLevel = 5;
 
         bool AutoGenerateTile(const ILevel::OctKey& k, std::string* val) const;
+        bool BuildAggregateTile(const ILevel::OctKey& k, std::string* val) const;
+        bool ReadValue(const std::string& k, std::string* val) const;
+        void RecordGet(const std::string& k, double micros) const;
+        static bool IsAggregateKey(const ILevel::OctKey& k);
+        static std::string DbKey(const std::string& k);
+        void AddWrite(leveldb::WriteBatch& batch, const std::string& k, const char* byte, size_t len);
+        static bool IsPartChunkKey(const ILevel::OctKey& k);
     public: 
         LevelSvr(bool disableWrite);
+        ~LevelSvr();
         void OpenDb(const std::string& path);
+        // Closes the db, flushing its log and waiting for compactions.
+        void CloseDb();
 
         bool GetValue(const std::string& key, std::string* val) const;
+        void GetValues(const std::vector<std::string>& keys, std::vector<std::string>* vals) const;
+        bool ScanRegion(const Loc& parent, int level,
+            const std::function<void(const Loc&, const std::string&)>& fn) const;
+        // Rewrites tile keys stored as raw OctKey structs into the Morton
+        // ordered encoding and part chunks stored as raw PartInst arrays into
+        // the PartChunk encoding.  Returns the number of entries converted.
+        size_t MigrateOctKeys();
         bool WriteValue(const std::string& key, const char* byte, size_t len);
+        bool WriteValues(const std::vector<std::pair<std::string, std::string>>& keyvals);
         ENetResponse HandleMessage(const ENetMsg::Header* msg);
+        bool IsOrdered(const ENetMsg::Header* msg) const;
+        // Request latencies, db hit rate and leveldb's own stats as text.
+        std::string GetStats() const;
     };
 
     class LevelCli : public ILevel {
         bool m_disableWrite;
         ENetClient *m_client;
-        mutable std::map<OctKey,
-            std::future<ENetResponse>> m_requests;
-        mutable std::map<OctKey, std::string> m_cache;
+        std::unique_ptr<ChunkCache> m_cache;
+
+        // A read in flight.  Keys written or invalidated since it was sent
+        // are recorded in stale, their results are already out of date.
+        struct PendingRead
+        {
+            std::unordered_set<OctKey, OctKey::Hash> stale;
+        };
+        mutable std::mutex m_readMtx;
+        mutable std::vector<PendingRead*> m_reads;
+        void BeginRead(PendingRead* read) const;
+        // Caches val unless key went stale during the read or the cache
+        // already has a newer entry.  Returns whether val was cached.
+        bool CacheRead(PendingRead* read, const OctKey& key, const PacketBuffer& val) const;
+        void EndRead(PendingRead* read) const;
+        // Call before changing key in the cache, so a read in flight doesn't
+        // put its older result back.
+        void MarkStale(const OctKey& key);
+
+        struct ChunkRequest
+        {
+            std::future<ENetResponse> future;
+            PendingRead read;
+        };
+        mutable std::map<OctKey, ChunkRequest> m_requests;
+        mutable std::mutex m_requestMtx;
+
+        // Only one prefetch batch is in flight, so prefetches never queue
+        // up ahead of the loader's own requests.  Chunks they brought in are
+        // remembered until used to count prefetch hits.
+        struct PrefetchBatch
+        {
+            std::vector<OctKey> keys;
+            std::future<ENetResponse> future;
+            PendingRead read;
+        };
+        mutable std::mutex m_prefetchMtx;
+        mutable std::unique_ptr<PrefetchBatch> m_prefetch;
+        mutable std::unordered_set<OctKey, OctKey::Hash> m_prefetched;
+        mutable std::atomic<uint64_t> m_prefetchRequested;
+        mutable std::atomic<uint64_t> m_prefetchUsed;
+        void CompletePrefetch() const;
+        void NoteCacheHit(const OctKey& key) const;
+
+        struct PendingWrite
+        {
+            std::string data;
+            std::vector<std::function<void(bool)>> callbacks;
+        };
+        // Writes to the same tile within WriteWindow are merged and sent
+        // together in one SetLevelValuesMsg by the writer thread.
+        std::map<OctKey, PendingWrite> m_pendingWrites;
+        std::chrono::steady_clock::time_point m_firstPendingWrite;
+        std::mutex m_writeMtx;
+        std::condition_variable m_writeCv;
+        std::thread m_writeThread;
+        bool m_exit;
+
+        // TileChanged keys waiting for TakeChangedKeys.
+        std::mutex m_changedMtx;
+        std::vector<OctKey> m_changedKeys;
+        bool m_changedOverflow;
+        // Batches sent whose response hasn't come back.  Their callbacks use
+        // this, so the destructor waits for them on m_writeCv.
+        int m_flushesInFlight;
+
+        void Invalidate(const OctKey& key);
+        void InvalidateParents(const Loc& l);
+        void WriteThread();
+        void FlushWrites(std::map<OctKey, PendingWrite>& writes);
     public:
-        LevelCli();
+        static constexpr std::chrono::milliseconds WriteWindow{ 50 };
+        static const size_t DefaultCacheBudget = 256 * 1024 * 1024;
+        static const size_t MaxPrefetchKeys = 64;
+        static const size_t MaxPrefetchedKeys = 4096;
+        static const size_t MaxChangedKeys = 4096;
+        LevelCli(size_t cacheBudget = DefaultCacheBudget);
+        ~LevelCli();
         void Connect(ENetClient *cli);
-        bool GetOctChunk(const ILevel::OctKey& l, std::string* val) const override;
+        const ChunkCache& Cache() const { return *m_cache; }
+        bool GetOctChunk(const ILevel::OctKey& l, PacketBuffer* val) const override;
+        bool GetOctChunks(const std::vector<OctKey>& keys, std::vector<PacketBuffer>* vals) const override;
+        bool ScanRegion(const Loc& parent, int level,
+            const std::function<void(const Loc&, const PacketBuffer&)>& fn) const override;
 
-        bool WriteOctChunk(const ILevel::OctKey& il, const char* byte, size_t len) override;
+        bool WriteOctChunk(const ILevel::OctKey& il, const char* byte, size_t len,
+            const std::function<void(bool)>& onComplete = nullptr) override;
         bool WritePlayerData(const PlayerData& pos) override;
         bool GetPlayerData(PlayerData& pos) override;
+        void Prefetch(const std::vector<OctKey>& keys) override;
+        PrefetchStats GetPrefetchStats() const override;
+        bool TakeChangedKeys(std::vector<OctKey>* keys) override;
     };
      
     struct GetLevelValueMsg : public ENetMsg
@@ -144,7 +349,282 @@ namespace sam
         };
 
     };   
+
+    struct GetLevelValuesMsg : public ENetMsg
+    {
+        std::vector<std::string> m_keys;
+        GetLevelValuesMsg(const std::vector<std::string>& keys) :
+            ENetMsg(Type::GetLevelDbValues),
+            m_keys(keys)
+        {}
+
+        GetLevelValuesMsg() {}
+
+        size_t GetSize() const override
+        {
+            size_t sz = ENetMsg::GetSize() +
+                sizeof(uint32_t);
+            for (const std::string& key : m_keys)
+                sz += sizeof(uint32_t) + key.size();
+            return sz;
+        }
+        virtual uint8_t* WriteData(uint8_t* data)
+        {
+            uint8_t* dataNext = ENetMsg::WriteData(data);
+            uint32_t ct = m_keys.size();
+            memcpy(dataNext, &ct, sizeof(ct));
+            dataNext += sizeof(ct);
+            for (const std::string& key : m_keys)
+            {
+                uint32_t sz = key.size();
+                memcpy(dataNext, &sz, sizeof(sz));
+                dataNext += sizeof(sz);
+                memcpy(dataNext, key.data(), sz);
+                dataNext += sz;
+            }
+            return dataNext;
+        }
+
+        virtual const uint8_t* ReadData(const uint8_t* data)
+        {
+            const uint8_t* dataNext = ENetMsg::ReadData(data);
+            uint32_t ct;
+            memcpy(&ct, dataNext, sizeof(ct));
+            dataNext += sizeof(ct);
+            m_keys.resize(ct);
+            for (std::string& key : m_keys)
+            {
+                uint32_t sz;
+                memcpy(&sz, dataNext, sizeof(sz));
+                dataNext += sizeof(sz);
+                key.resize(sz);
+                memcpy(key.data(), dataNext, sz);
+                dataNext += sz;
+            }
+            return dataNext;
+        }
+
+        // Response payload is a sequence of [uint32 size][bytes], one per key.
+        static void WriteValues(const std::vector<std::string>& vals, std::string* out)
+        {
+            size_t total = 0;
+            for (const std::string& val : vals)
+                total += sizeof(uint32_t) + val.size();
+            out->resize(total);
+            char* dataNext = out->data();
+            for (const std::string& val : vals)
+            {
+                uint32_t sz = val.size();
+                memcpy(dataNext, &sz, sizeof(sz));
+                dataNext += sizeof(sz);
+                memcpy(dataNext, val.data(), sz);
+                dataNext += sz;
+            }
+        }
+
+        // Values are returned as slices sharing the response buffer.
+        static bool ReadValues(const PacketBuffer& in, size_t count, std::vector<PacketBuffer>* vals)
+        {
+            vals->resize(count);
+            size_t offset = 0;
+            for (PacketBuffer& val : *vals)
+            {
+                uint32_t sz;
+                if (offset + sizeof(sz) > in.size())
+                    return false;
+                memcpy(&sz, in.data() + offset, sizeof(sz));
+                offset += sizeof(sz);
+                if (offset + sz > in.size())
+                    return false;
+                val = in.Slice(offset, sz);
+                offset += sz;
+            }
+            return true;
+        }
+    };
    
+    struct ScanLevelRegionMsg : public ENetMsg
+    {
+        Loc m_parent;
+        int m_level;
+        ScanLevelRegionMsg(const Loc& parent, int level) :
+            ENetMsg(Type::ScanLevelDbRegion),
+            m_parent(parent),
+            m_level(level)
+        {}
+
+        ScanLevelRegionMsg() {}
+
+        size_t GetSize() const override
+        {
+            return ENetMsg::GetSize() +
+                sizeof(m_parent) +
+                sizeof(m_level);
+        }
+        virtual uint8_t* WriteData(uint8_t* data)
+        {
+            uint8_t* dataNext = ENetMsg::WriteData(data);
+            memcpy(dataNext, &m_parent, sizeof(m_parent));
+            dataNext += sizeof(m_parent);
+            memcpy(dataNext, &m_level, sizeof(m_level));
+            dataNext += sizeof(m_level);
+            return dataNext;
+        }
+
+        virtual const uint8_t* ReadData(const uint8_t* data)
+        {
+            const uint8_t* dataNext = ENetMsg::ReadData(data);
+            memcpy(&m_parent, dataNext, sizeof(m_parent));
+            dataNext += sizeof(m_parent);
+            memcpy(&m_level, dataNext, sizeof(m_level));
+            dataNext += sizeof(m_level);
+            return dataNext;
+        }
+
+        // Response payload is a sequence of [Loc][uint32 size][bytes].
+        static void AppendValue(const Loc& l, const std::string& val, std::string* out)
+        {
+            size_t offset = out->size();
+            uint32_t sz = val.size();
+            out->resize(offset + sizeof(l) + sizeof(sz) + sz);
+            char* dataNext = out->data() + offset;
+            memcpy(dataNext, &l, sizeof(l));
+            dataNext += sizeof(l);
+            memcpy(dataNext, &sz, sizeof(sz));
+            dataNext += sizeof(sz);
+            memcpy(dataNext, val.data(), sz);
+        }
+
+        static bool ReadValues(const PacketBuffer& in,
+            const std::function<void(const Loc&, PacketBuffer&&)>& fn)
+        {
+            size_t offset = 0;
+            while (offset < in.size())
+            {
+                Loc l;
+                uint32_t sz;
+                if (offset + sizeof(l) + sizeof(sz) > in.size())
+                    return false;
+                memcpy(&l, in.data() + offset, sizeof(l));
+                offset += sizeof(l);
+                memcpy(&sz, in.data() + offset, sizeof(sz));
+                offset += sizeof(sz);
+                if (offset + sz > in.size())
+                    return false;
+                fn(l, in.Slice(offset, sz));
+                offset += sz;
+            }
+            return true;
+        }
+    };
+
+    struct TileChangedMsg : public ENetMsg
+    {
+        std::vector<ILevel::OctKey> m_keys;
+        TileChangedMsg(const std::vector<ILevel::OctKey>& keys) :
+            ENetMsg(Type::TileChanged),
+            m_keys(keys)
+        {}
+
+        TileChangedMsg() {}
+
+        size_t GetSize() const override
+        {
+            return ENetMsg::GetSize() +
+                sizeof(uint32_t) +
+                m_keys.size() * sizeof(ILevel::OctKey);
+        }
+        virtual uint8_t* WriteData(uint8_t* data)
+        {
+            uint8_t* dataNext = ENetMsg::WriteData(data);
+            uint32_t ct = m_keys.size();
+            memcpy(dataNext, &ct, sizeof(ct));
+            dataNext += sizeof(ct);
+            memcpy(dataNext, m_keys.data(), ct * sizeof(ILevel::OctKey));
+            dataNext += ct * sizeof(ILevel::OctKey);
+            return dataNext;
+        }
+
+        virtual const uint8_t* ReadData(const uint8_t* data)
+        {
+            const uint8_t* dataNext = ENetMsg::ReadData(data);
+            uint32_t ct;
+            memcpy(&ct, dataNext, sizeof(ct));
+            dataNext += sizeof(ct);
+            m_keys.resize(ct);
+            memcpy(m_keys.data(), dataNext, ct * sizeof(ILevel::OctKey));
+            dataNext += ct * sizeof(ILevel::OctKey);
+            return dataNext;
+        }
+    };
+
+    struct SetLevelValuesMsg : public ENetMsg
+    {
+        std::vector<std::pair<std::string, std::string>> m_keyvals;
+
+        SetLevelValuesMsg(std::vector<std::pair<std::string, std::string>>&& keyvals) :
+            ENetMsg(Type::SetLevelDbValues),
+            m_keyvals(std::move(keyvals))
+        {}
+
+        SetLevelValuesMsg() : ENetMsg(Type::SetLevelDbValues) {}
+
+        size_t GetSize() const override
+        {
+            size_t sz = ENetMsg::GetSize() +
+                sizeof(uint32_t);
+            for (const auto& kv : m_keyvals)
+                sz += sizeof(uint32_t) + kv.first.size() +
+                    sizeof(uint32_t) + kv.second.size();
+            return sz;
+        }
+        virtual uint8_t* WriteData(uint8_t* data)
+        {
+            uint8_t* dataNext = ENetMsg::WriteData(data);
+            uint32_t ct = m_keyvals.size();
+            memcpy(dataNext, &ct, sizeof(ct));
+            dataNext += sizeof(ct);
+            for (const auto& kv : m_keyvals)
+            {
+                uint32_t sz = kv.first.size();
+                memcpy(dataNext, &sz, sizeof(sz));
+                dataNext += sizeof(sz);
+                memcpy(dataNext, kv.first.data(), sz);
+                dataNext += sz;
+
+                sz = kv.second.size();
+                memcpy(dataNext, &sz, sizeof(sz));
+                dataNext += sizeof(sz);
+                memcpy(dataNext, kv.second.data(), sz);
+                dataNext += sz;
+            }
+            return dataNext;
+        }
+
+        virtual const uint8_t* ReadData(const uint8_t* data)
+        {
+            const uint8_t* dataNext = ENetMsg::ReadData(data);
+            uint32_t ct;
+            memcpy(&ct, dataNext, sizeof(ct));
+            dataNext += sizeof(ct);
+            m_keyvals.resize(ct);
+            for (auto& kv : m_keyvals)
+            {
+                uint32_t sz;
+                memcpy(&sz, dataNext, sizeof(sz));
+                dataNext += sizeof(sz);
+                kv.first.assign((const char*)dataNext, sz);
+                dataNext += sz;
+
+                memcpy(&sz, dataNext, sizeof(sz));
+                dataNext += sizeof(sz);
+                kv.second.assign((const char*)dataNext, sz);
+                dataNext += sz;
+            }
+            return dataNext;
+        }
+    };
+
     struct SetLevelValueMsg : public ENetMsg
     {
         std::string m_key;
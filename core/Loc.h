@@ -1,5 +1,7 @@
 #pragma once
 
+#include <array>
+
 using namespace gmtl;
 namespace sam
 {
@@ -42,17 +44,74 @@ namespace sam
                 l.m_z;
         }
         
-        template <int L>
-        static Loc FromPoint(const Point3f& pt)
+        // Interleaves x, y and z (lsize bits each) into a Z-order code, so
+        // the children of a tile at any level form one contiguous range.
+        static constexpr uint64_t SpreadBits(uint64_t v)
+        {
+            v &= 0x1fffff;
+            v = (v | v << 32) & 0x1f00000000ffff;
+            v = (v | v << 16) & 0x1f0000ff0000ff;
+            v = (v | v << 8) & 0x100f00f00f00f00f;
+            v = (v | v << 4) & 0x10c30c30c30c30c3;
+            v = (v | v << 2) & 0x1249249249249249;
+            return v;
+        }
+
+        static constexpr uint64_t CompactBits(uint64_t v)
+        {
+            v &= 0x1249249249249249;
+            v = (v ^ (v >> 2)) & 0x10c30c30c30c30c3;
+            v = (v ^ (v >> 4)) & 0x100f00f00f00f00f;
+            v = (v ^ (v >> 8)) & 0x1f0000ff0000ff;
+            v = (v ^ (v >> 16)) & 0x1f00000000ffff;
+            v = (v ^ (v >> 32)) & 0x1fffff;
+            return v;
+        }
+
+        uint64_t GetMortonCode() const
+        {
+            return (SpreadBits(m_x) << 2) |
+                (SpreadBits(m_y) << 1) |
+                SpreadBits(m_z);
+        }
+
+        static Loc FromMortonCode(uint64_t code, int l)
         {
-            constexpr int off = (1 << (L - 1));
-            constexpr float div = 16.0f / (1 << L);
-            Loc l(
+            return Loc((int)CompactBits(code >> 2),
+                (int)CompactBits(code >> 1),
+                (int)CompactBits(code), l);
+        }
+
+        // Level in the top bits and the Z-order code below, unique across
+        // levels so tiles of every level can share one hash table.
+        uint64_t GetPackedCode() const
+        {
+            return ((uint64_t)m_l << 56) | GetMortonCode();
+        }
+
+        static Loc FromPackedCode(uint64_t code)
+        {
+            return FromMortonCode(code & ((1ull << 56) - 1), (int)(code >> 56));
+        }
+
+        // The level l tile containing pt.
+        static Loc FromPoint(const Point3f& pt, int l)
+        {
+            if (l == 0)
+                return Loc(0, 0, 0, 0);
+            int off = (1 << (l - 1));
+            float div = (float)(1 << l) / (1 << lsize);
+            return Loc(
                 (int)floor(pt[0] * div) + off,
                 (int)floor(pt[1] * div) + off,
                 (int)floor(pt[2] * div) + off,
-                L);
-            return l;
+                l);
+        }
+
+        template <int L>
+        static Loc FromPoint(const Point3f& pt)
+        {
+            return FromPoint(pt, L);
         }
         static constexpr void GetLocFromIndex(Loc& loc, uint64_t index)
         {
@@ -109,17 +168,17 @@ namespace sam
             return Point3f(ox + (m_x + 0.5f) * dist, oy + (m_y + 0.5f) * dist, oz + (m_z + 0.5f) * dist);
         }
 
-        std::vector<Loc> GetChildren() const
+        // Child idx has x in bit 2, y in bit 1 and z in bit 0.
+        Loc GetChild(int idx) const
+        {
+            return Loc(m_x * 2 + ((idx >> 2) & 1), m_y * 2 + ((idx >> 1) & 1), m_z * 2 + (idx & 1), m_l + 1);
+        }
+
+        std::array<Loc, 8> GetChildren() const
         {
-            return std::vector<Loc>{
-                Loc(m_x * 2, m_y * 2, m_z * 2, m_l + 1),
-                    Loc(m_x * 2, m_y * 2, m_z * 2 + 1, m_l + 1),
-                    Loc(m_x * 2, m_y * 2 + 1, m_z * 2, m_l + 1),
-                    Loc(m_x * 2, m_y * 2 + 1, m_z * 2 + 1, m_l + 1),
-                    Loc(m_x * 2 + 1, m_y * 2, m_z * 2, m_l + 1),
-                    Loc(m_x * 2 + 1, m_y * 2, m_z * 2 + 1, m_l + 1),
-                    Loc(m_x * 2 + 1, m_y * 2 + 1, m_z * 2, m_l + 1),
-                    Loc(m_x * 2 + 1, m_y * 2 + 1, m_z * 2 + 1, m_l + 1)
+            return std::array<Loc, 8>{
+                GetChild(0), GetChild(1), GetChild(2), GetChild(3),
+                GetChild(4), GetChild(5), GetChild(6), GetChild(7)
             };
         }
 
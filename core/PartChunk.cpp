@@ -0,0 +1,233 @@
+#include "StdIncludes.h"
+#include "PartChunk.h"
+
+namespace sam
+{
+    static const char Magic[3] = { 0, 'P', 'C' };
+
+    template <class T> static void Append(std::string* out, const T& val)
+    {
+        out->append((const char*)&val, sizeof(T));
+    }
+
+    template <class T> static bool Read(const uint8_t*& ptr, const uint8_t* end, T* val)
+    {
+        if (end - ptr < (ptrdiff_t)sizeof(T))
+            return false;
+        memcpy(val, ptr, sizeof(T));
+        ptr += sizeof(T);
+        return true;
+    }
+
+    const std::vector<Quatf>& PartChunk::Rotations()
+    {
+        // The 24 orientations reachable by 90 degree turns, built by closing
+        // the identity under quarter turns about x and y.
+        static const std::vector<Quatf> rotations = []()
+        {
+            const float h = sqrtf(0.5f);
+            const Quatf turns[2] = { Quatf(h, 0, 0, h), Quatf(0, h, 0, h) };
+            std::vector<Quatf> rots{ Quatf() };
+            for (size_t idx = 0; idx < rots.size(); ++idx)
+            {
+                for (const Quatf& t : turns)
+                {
+                    Quatf q = rots[idx] * t;
+                    bool found = false;
+                    for (const Quatf& r : rots)
+                        found |= fabsf(dot(q, r)) > 0.999f;
+                    if (!found)
+                        rots.push_back(q);
+                }
+            }
+            // Snap away the float error from composing turns.
+            for (Quatf& r : rots)
+            {
+                for (int c = 0; c < 4; ++c)
+                {
+                    float v = r[c];
+                    float snapped = fabsf(v) < 0.25f ? 0 : (fabsf(v) < 0.6f ? 0.5f : (fabsf(v) < 0.85f ? h : 1.0f));
+                    r[c] = v < 0 ? -snapped : snapped;
+                }
+            }
+            return rots;
+        }();
+        return rotations;
+    }
+
+    uint8_t PartChunk::RotationIndex(const Quatf& q)
+    {
+        const std::vector<Quatf>& rots = Rotations();
+        for (size_t idx = 0; idx < rots.size(); ++idx)
+        {
+            // q and -q are the same rotation.
+            if (fabsf(dot(q, rots[idx])) > 1 - 1e-6f)
+                return (uint8_t)idx;
+        }
+        return FullRotation;
+    }
+
+    bool PartChunk::IsEncoded(const void* data, size_t size)
+    {
+        return size >= HeaderSize && memcmp(data, Magic, sizeof(Magic)) == 0;
+    }
+
+    void PartChunk::Encode(const PartInst* parts, size_t count, std::string* out)
+    {
+        out->clear();
+        std::map<PartId, uint16_t> dictIdx;
+        std::vector<const PartId*> dict;
+        for (size_t idx = 0; idx < count; ++idx)
+        {
+            if (dictIdx.insert(std::make_pair(parts[idx].id, (uint16_t)dict.size())).second)
+                dict.push_back(&parts[idx].id);
+        }
+
+        out->reserve(HeaderSize + 2 + dict.size() * 9 + count * 11);
+        out->append(Magic, sizeof(Magic));
+        Append(out, Version);
+        Append(out, (uint32_t)count);
+        Append(out, (uint16_t)dict.size());
+        for (const PartId* id : dict)
+        {
+            uint8_t len = (uint8_t)strnlen(id->_id, sizeof(id->_id));
+            Append(out, len);
+            out->append(id->_id, len);
+        }
+
+        for (size_t idx = 0; idx < count; ++idx)
+        {
+            const PartInst& pi = parts[idx];
+            int16_t qpos[3];
+            bool onGrid = true;
+            for (int c = 0; c < 3; ++c)
+            {
+                float q = roundf(pi.pos[c] / PosUnit);
+                onGrid &= q >= INT16_MIN && q <= INT16_MAX &&
+                    fabsf(q * PosUnit - pi.pos[c]) <= 1e-4f;
+                qpos[c] = onGrid ? (int16_t)q : 0;
+            }
+            bool wideAtlas = pi.atlasidx < 0 || pi.atlasidx > UINT16_MAX;
+            uint8_t flags = (pi.connected ? Connected : 0) |
+                (pi.canBeDestroyed ? CanBeDestroyed : 0) |
+                (onGrid ? 0 : FloatPos) |
+                (wideAtlas ? WideAtlas : 0);
+            Append(out, flags);
+            uint16_t partIdx = dictIdx[pi.id];
+            if (dict.size() > 256)
+                Append(out, partIdx);
+            else
+                Append(out, (uint8_t)partIdx);
+            if (wideAtlas)
+                Append(out, (int32_t)pi.atlasidx);
+            else
+                Append(out, (uint16_t)pi.atlasidx);
+            if (onGrid)
+                Append(out, qpos);
+            else
+                Append(out, pi.pos);
+            uint8_t rotIdx = RotationIndex(pi.rot);
+            Append(out, rotIdx);
+            if (rotIdx == FullRotation)
+                Append(out, pi.rot);
+        }
+    }
+
+    bool PartChunk::Decode(const void* data, size_t size, std::vector<PartInst>* parts)
+    {
+        parts->clear();
+        if (!IsEncoded(data, size))
+        {
+            if (size % sizeof(PartInst) != 0)
+                return false;
+            parts->resize(size / sizeof(PartInst));
+            memcpy(parts->data(), data, size);
+            return true;
+        }
+
+        const uint8_t* ptr = (const uint8_t*)data + sizeof(Magic);
+        const uint8_t* end = (const uint8_t*)data + size;
+        uint8_t version;
+        uint32_t count;
+        uint16_t dictCount;
+        if (!Read(ptr, end, &version) || version > Version ||
+            !Read(ptr, end, &count) || !Read(ptr, end, &dictCount))
+            return false;
+
+        std::vector<PartId> dict(dictCount);
+        for (PartId& id : dict)
+        {
+            uint8_t len;
+            if (!Read(ptr, end, &len) || len > sizeof(id._id) || end - ptr < len)
+                return false;
+            memcpy(id._id, ptr, len);
+            ptr += len;
+        }
+
+        const std::vector<Quatf>& rots = Rotations();
+        parts->resize(count);
+        for (PartInst& pi : *parts)
+        {
+            uint8_t flags;
+            uint16_t idx = 0;
+            if (!Read(ptr, end, &flags))
+                return false;
+            if (dict.size() > 256)
+            {
+                if (!Read(ptr, end, &idx))
+                    return false;
+            }
+            else
+            {
+                uint8_t narrowIdx;
+                if (!Read(ptr, end, &narrowIdx))
+                    return false;
+                idx = narrowIdx;
+            }
+            if (idx >= dict.size())
+                return false;
+            pi.id = dict[idx];
+            pi.connected = (flags & Connected) != 0;
+            pi.canBeDestroyed = (flags & CanBeDestroyed) != 0;
+            if (flags & WideAtlas)
+            {
+                int32_t atlasidx;
+                if (!Read(ptr, end, &atlasidx))
+                    return false;
+                pi.atlasidx = atlasidx;
+            }
+            else
+            {
+                uint16_t atlasidx;
+                if (!Read(ptr, end, &atlasidx))
+                    return false;
+                pi.atlasidx = atlasidx;
+            }
+            if (flags & FloatPos)
+            {
+                if (!Read(ptr, end, &pi.pos))
+                    return false;
+            }
+            else
+            {
+                int16_t qpos[3];
+                if (!Read(ptr, end, &qpos))
+                    return false;
+                pi.pos = Vec3f(qpos[0] * PosUnit, qpos[1] * PosUnit, qpos[2] * PosUnit);
+            }
+            uint8_t rotIdx;
+            if (!Read(ptr, end, &rotIdx))
+                return false;
+            if (rotIdx == FullRotation)
+            {
+                if (!Read(ptr, end, &pi.rot))
+                    return false;
+            }
+            else if (rotIdx < rots.size())
+                pi.rot = rots[rotIdx];
+            else
+                return false;
+        }
+        return true;
+    }
+}
@@ -0,0 +1,49 @@
+#pragma once
+
+#include <vector>
+#include <string>
+#include "PartDefs.h"
+
+namespace sam
+{
+    // Compact, versioned encoding of the parts stored in a tile chunk.  Part
+    // ids go into a per-chunk dictionary.  Positions are stored as quarter
+    // LDU fixed point and rotations as an index into the 24 axis aligned
+    // orientations.  Parts that are off grid or off axis fall back to floats.
+    //
+    // Layout (version 1, little endian):
+    //   u8 0, 'P', 'C', u8 version, u32 partCount
+    //   u16 dictCount, dictCount x { u8 len, char id[len] }
+    //   partCount x { u8 flags, u8 dictIdx | u16 dictIdx (dictCount > 256),
+    //                 u16 atlasidx | i32 atlasidx,
+    //                 i16 pos[3] | f32 pos[3], u8 rotIdx [f32 rot[4]] }
+    class PartChunk
+    {
+    public:
+        static constexpr uint8_t Version = 1;
+        // World units per fixed point step: a quarter LDU.
+        static constexpr float PosUnit = 1.0f / 80.0f;
+
+        static void Encode(const PartInst* parts, size_t count, std::string* out);
+        static void Encode(const std::vector<PartInst>& parts, std::string* out)
+        { Encode(parts.data(), parts.size(), out); }
+        // Also reads chunks written as a raw PartInst array before the
+        // encoding existed.
+        static bool Decode(const void* data, size_t size, std::vector<PartInst>* parts);
+        static bool IsEncoded(const void* data, size_t size);
+
+    private:
+        enum Flags : uint8_t
+        {
+            Connected = 1,
+            CanBeDestroyed = 2,
+            FloatPos = 4,
+            WideAtlas = 8
+        };
+        static constexpr uint8_t FullRotation = 0xFF;
+        static constexpr size_t HeaderSize = 8;
+
+        static const std::vector<Quatf>& Rotations();
+        static uint8_t RotationIndex(const Quatf& q);
+    };
+}
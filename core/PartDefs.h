@@ -51,6 +51,14 @@ namespace sam
         return strncmp(lhs._id, rhs._id, sizeof(lhs._id)) == 0;
     }
 
+    // Names a part in a loaded tile.  A slot's generation changes when
+    // its part is removed, so old handles stop matching.
+    struct PartHandle
+    {
+        uint32_t slot = UINT32_MAX;
+        uint32_t generation = 0;
+    };
+
     struct SlotPart
     {
         PartId id;
@@ -23,4 +23,12 @@ namespace sam
     {
         return m_levelSvr->HandleMessage(msg);
     }
+    bool Server::IsOrdered(const ENetMsg::Header* msg) const
+    {
+        return m_levelSvr->IsOrdered(msg);
+    }
+    std::string Server::GetStats() const
+    {
+        return m_levelSvr->GetStats();
+    }
 }
@@ -4,10 +4,13 @@ namespace sam
     class LevelSvr;
     class Server : public IServerHandler
     {
-        std::unique_ptr<ENetServer> m_server;
+        // Declared first so the db outlives the server's worker threads.
         std::unique_ptr<LevelSvr> m_levelSvr;
+        std::unique_ptr<ENetServer> m_server;
     public:
         void Start(const std::string& path, const std::string& hostaddr, int hostport);
         ENetResponse HandleMessage(const ENetMsg::Header* msg);
+        bool IsOrdered(const ENetMsg::Header* msg) const;
+        std::string GetStats() const;
     };
 }
\ No newline at end of file
@@ -0,0 +1,36 @@
+#include "StdIncludes.h"
+#include "Stats.h"
+#include "util/histogram.h"
+
+namespace sam
+{
+    LatencyHistogram::LatencyHistogram() :
+        m_hist(std::make_unique<leveldb::Histogram>()),
+        m_count(0)
+    {
+        m_hist->Clear();
+    }
+
+    LatencyHistogram::~LatencyHistogram()
+    {
+    }
+
+    void LatencyHistogram::Add(double micros)
+    {
+        std::lock_guard lock(m_mtx);
+        m_hist->Add(micros);
+        m_count++;
+    }
+
+    uint64_t LatencyHistogram::Count() const
+    {
+        std::lock_guard lock(m_mtx);
+        return m_count;
+    }
+
+    std::string LatencyHistogram::ToString() const
+    {
+        std::lock_guard lock(m_mtx);
+        return m_hist->ToString();
+    }
+}
\ No newline at end of file
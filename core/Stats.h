@@ -0,0 +1,50 @@
+#pragma once
+
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <string>
+
+namespace leveldb
+{
+    class Histogram;
+}
+
+namespace sam
+{
+    // Thread safe wrapper over leveldb's histogram.  Values are microseconds.
+    class LatencyHistogram
+    {
+        mutable std::mutex m_mtx;
+        std::unique_ptr<leveldb::Histogram> m_hist;
+        uint64_t m_count;
+    public:
+        LatencyHistogram();
+        ~LatencyHistogram();
+        void Add(double micros);
+        uint64_t Count() const;
+        std::string ToString() const;
+    };
+
+    // Adds the time from construction to destruction to a histogram.
+    class ScopedLatency
+    {
+        LatencyHistogram& m_hist;
+        std::chrono::steady_clock::time_point m_start;
+    public:
+        ScopedLatency(LatencyHistogram& hist) :
+            m_hist(hist),
+            m_start(std::chrono::steady_clock::now()) {}
+        ~ScopedLatency()
+        {
+            m_hist.Add(MicrosSince(m_start));
+        }
+
+        static double MicrosSince(std::chrono::steady_clock::time_point start)
+        {
+            return std::chrono::duration<double, std::micro>(
+                std::chrono::steady_clock::now() - start).count();
+        }
+    };
+}
\ No newline at end of file
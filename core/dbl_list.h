@@ -1,3 +1,5 @@
+#pragma once
+
 namespace sam
 {
 #define DLLSTTEST 1
@@ -50,28 +52,30 @@ namespace sam
         {
             if (head == tail) // one node, must be us
             { 
-#if DLLSTTEST
+#if DLLSTTEST && defined(_WIN32)
                 if (node != head || node != tail)
                     __debugbreak();
 #endif
                 head = tail = nullptr; 
-                return;
             }
-            if (node == head)
+            else if (node == head)
             { 
                 head = node->next; 
                 node->next->prev = nullptr;
-                return;
             }
-            if (node == tail)
+            else if (node == tail)
             {
                 tail = node->prev;
                 node->prev->next = nullptr;
-                return;
             }
-
-            node->prev->next = node->next;
-            node->next->prev = node->prev;
+            else
+            {
+                node->prev->next = node->next;
+                node->next->prev = node->prev;
+            }
+            // Clear the links so the node can be inserted again
+            node->next = nullptr;
+            node->prev = nullptr;
         }
 
     private:
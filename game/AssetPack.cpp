@@ -0,0 +1,241 @@
+#include "StdIncludes.h"
+#include "AssetPack.h"
+#include "ZipFile.h"
+#include <algorithm>
+#include <cstring>
+#include <filesystem>
+#include <string_view>
+#ifdef _WIN32
+#define NOMINMAX
+#include <Windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace sam
+{
+    static const char PackMagic[4] = { 'B', 'P', 'A', 'K' };
+
+    AssetPack::AssetPack() :
+        m_base(nullptr),
+        m_size(0),
+        m_entries(nullptr),
+        m_count(0),
+        m_names(nullptr)
+#ifdef _WIN32
+        , m_file(INVALID_HANDLE_VALUE),
+        m_mapping(nullptr)
+#endif
+    {
+    }
+
+    AssetPack::~AssetPack()
+    {
+        Close();
+    }
+
+    bool AssetPack::Open(const std::string& path)
+    {
+        Close();
+#ifdef _WIN32
+        HANDLE file = CreateFileW(std::filesystem::path(path).wstring().c_str(), GENERIC_READ,
+            FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+        if (file == INVALID_HANDLE_VALUE)
+            return false;
+        m_file = file;
+        LARGE_INTEGER size;
+        if (!GetFileSizeEx(file, &size) || size.QuadPart == 0)
+        {
+            Close();
+            return false;
+        }
+        m_mapping = CreateFileMappingW(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+        if (m_mapping == nullptr)
+        {
+            Close();
+            return false;
+        }
+        m_base = (const uint8_t*)MapViewOfFile(m_mapping, FILE_MAP_READ, 0, 0, 0);
+        m_size = (size_t)size.QuadPart;
+#else
+        int fd = open(path.c_str(), O_RDONLY);
+        if (fd < 0)
+            return false;
+        struct stat st;
+        if (fstat(fd, &st) != 0 || st.st_size == 0)
+        {
+            close(fd);
+            return false;
+        }
+        // The mapping keeps the file alive after the descriptor is closed.
+        void* base = mmap(nullptr, (size_t)st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+        close(fd);
+        if (base == MAP_FAILED)
+            return false;
+        m_base = (const uint8_t*)base;
+        m_size = (size_t)st.st_size;
+#endif
+        if (m_base == nullptr || !Validate())
+        {
+            Close();
+            return false;
+        }
+        return true;
+    }
+
+    void AssetPack::Close()
+    {
+#ifdef _WIN32
+        if (m_base != nullptr)
+            UnmapViewOfFile(m_base);
+        if (m_mapping != nullptr)
+            CloseHandle(m_mapping);
+        if (m_file != INVALID_HANDLE_VALUE)
+            CloseHandle(m_file);
+        m_mapping = nullptr;
+        m_file = INVALID_HANDLE_VALUE;
+#else
+        if (m_base != nullptr)
+            munmap((void*)m_base, m_size);
+#endif
+        m_base = nullptr;
+        m_size = 0;
+        m_entries = nullptr;
+        m_count = 0;
+        m_names = nullptr;
+    }
+
+    bool AssetPack::Validate()
+    {
+        if (m_size < sizeof(Header))
+            return false;
+        const Header* hdr = (const Header*)m_base;
+        if (memcmp(hdr->magic, PackMagic, sizeof(PackMagic)) != 0 ||
+            hdr->version != Version)
+            return false;
+        if (hdr->indexOffset % alignof(Entry) != 0 ||
+            hdr->indexOffset > m_size ||
+            hdr->count > (m_size - hdr->indexOffset) / sizeof(Entry) ||
+            hdr->namesOffset > m_size ||
+            hdr->namesSize > m_size - hdr->namesOffset)
+            return false;
+        m_entries = (const Entry*)(m_base + hdr->indexOffset);
+        m_count = (size_t)hdr->count;
+        m_names = (const char*)(m_base + hdr->namesOffset);
+        for (size_t idx = 0; idx < m_count; ++idx)
+        {
+            const Entry& e = m_entries[idx];
+            if (e.offset > m_size || e.size > m_size - e.offset ||
+                (uint64_t)e.nameOffset + e.nameLen > hdr->namesSize)
+                return false;
+        }
+        return true;
+    }
+
+    bool AssetPack::Find(const std::string& name, const uint8_t** data, size_t* size) const
+    {
+        if (m_base == nullptr)
+            return false;
+        const char* names = m_names;
+        auto nameOf = [names](const Entry& e)
+            { return std::string_view(names + e.nameOffset, e.nameLen); };
+        const Entry* end = m_entries + m_count;
+        const Entry* it = std::lower_bound(m_entries, end, std::string_view(name),
+            [&nameOf](const Entry& e, std::string_view n) { return nameOf(e) < n; });
+        if (it == end || nameOf(*it) != name)
+            return false;
+        *data = m_base + it->offset;
+        *size = (size_t)it->size;
+        return true;
+    }
+
+    vecstream AssetPack::ReadFile(const std::string& name) const
+    {
+        const uint8_t* data;
+        size_t size;
+        if (!Find(name, &data, &size))
+            return vecstream();
+        return vecstream(data, size);
+    }
+
+    bool AssetPack::Build(const ZipFile& zip, const std::string& path, const DeriveFn& derive)
+    {
+        std::vector<std::string> files = zip.ListFiles();
+        std::sort(files.begin(), files.end());
+
+        // Written next to the pack and renamed over it once complete, so a
+        // crash never leaves a truncated pack behind.
+        std::string tmpPath = path + ".tmp";
+        std::ofstream ofs(tmpPath, std::ios::out | std::ios::binary | std::ios::trunc);
+        if (!ofs)
+            return false;
+        auto pad = [&ofs](size_t align)
+        {
+            static const char zeros[DataAlign] = {};
+            size_t pos = (size_t)ofs.tellp();
+            size_t padding = (align - pos % align) % align;
+            ofs.write(zeros, padding);
+        };
+
+        Header hdr = {};
+        ofs.write((const char*)&hdr, sizeof(hdr));
+        pad(DataAlign);
+        std::vector<Entry> entries;
+        std::string names;
+        entries.reserve(files.size());
+        auto writeFile = [&](const std::string& name, const uint8_t* data, size_t size)
+        {
+            pad(FileAlign);
+            Entry e;
+            e.offset = (uint64_t)ofs.tellp();
+            e.size = size;
+            e.nameOffset = (uint32_t)names.size();
+            e.nameLen = (uint32_t)name.size();
+            ofs.write((const char*)data, size);
+            names += name;
+            entries.push_back(e);
+        };
+        std::vector<std::pair<std::string, std::vector<uint8_t>>> derived;
+        for (const std::string& file : files)
+        {
+            vecstream stream = zip.ReadFile(file);
+            writeFile(file, stream.data(), stream.length());
+            if (derive == nullptr)
+                continue;
+            derived.clear();
+            derive(file, stream, derived);
+            for (const auto& d : derived)
+                writeFile(d.first, d.second.data(), d.second.size());
+        }
+
+        // Derived files break the zip's order.
+        const char* namesPtr = names.data();
+        std::sort(entries.begin(), entries.end(), [namesPtr](const Entry& a, const Entry& b)
+            {
+                return std::string_view(namesPtr + a.nameOffset, a.nameLen) <
+                    std::string_view(namesPtr + b.nameOffset, b.nameLen);
+            });
+
+        pad(alignof(Entry));
+        memcpy(hdr.magic, PackMagic, sizeof(PackMagic));
+        hdr.version = Version;
+        hdr.count = entries.size();
+        hdr.indexOffset = (uint64_t)ofs.tellp();
+        ofs.write((const char*)entries.data(), entries.size() * sizeof(Entry));
+        hdr.namesOffset = (uint64_t)ofs.tellp();
+        hdr.namesSize = names.size();
+        ofs.write(names.data(), names.size());
+        ofs.seekp(0);
+        ofs.write((const char*)&hdr, sizeof(hdr));
+        ofs.close();
+        if (!ofs)
+            return false;
+
+        std::error_code ec;
+        std::filesystem::rename(tmpPath, path, ec);
+        return !ec;
+    }
+}
\ No newline at end of file
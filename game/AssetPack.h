@@ -0,0 +1,77 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <functional>
+
+namespace sam
+{
+    class ZipFile;
+    class vecstream;
+
+    // Read only archive of uncompressed files, mapped into memory once.  The
+    // data starts on a page boundary with each file 16 byte aligned, and a
+    // name sorted index at the end is binary searched, so reads are lock
+    // free and hand out views of the mapping.
+    class AssetPack
+    {
+    public:
+        AssetPack();
+        ~AssetPack();
+
+        bool Open(const std::string& path);
+        bool IsOpen() const { return m_base != nullptr; }
+
+        // Zero copy view of name, valid while the pack is open.  Empty if
+        // there is no such file.
+        vecstream ReadFile(const std::string& name) const;
+        bool Find(const std::string& name, const uint8_t** data, size_t* size) const;
+
+        // Called with each file in the zip, adds files generated from it to
+        // the pack.
+        using DeriveFn = std::function<void(const std::string& name, const vecstream& data,
+            std::vector<std::pair<std::string, std::vector<uint8_t>>>& derived)>;
+
+        // Writes every file in zip, and any derive adds, to a pack at path.
+        static bool Build(const ZipFile& zip, const std::string& path,
+            const DeriveFn& derive = nullptr);
+
+    private:
+        // Bumped when the pack's contents change, older packs fail to open.
+        static const uint32_t Version = 2;
+        static const size_t DataAlign = 4096;
+        static const size_t FileAlign = 16;
+
+        struct Header
+        {
+            char magic[4];
+            uint32_t version;
+            uint64_t count;
+            uint64_t indexOffset;
+            uint64_t namesOffset;
+            uint64_t namesSize;
+        };
+
+        struct Entry
+        {
+            uint64_t offset;
+            uint64_t size;
+            uint32_t nameOffset;
+            uint32_t nameLen;
+        };
+
+        const uint8_t* m_base;
+        size_t m_size;
+        const Entry* m_entries;
+        size_t m_count;
+        const char* m_names;
+#ifdef _WIN32
+        void* m_file;
+        void* m_mapping;
+#endif
+
+        void Close();
+        bool Validate();
+    };
+}
\ No newline at end of file
@@ -14,11 +14,13 @@
 #define FMT_HEADER_ONLY 1
 #include <fmt/format.h>
 #include "Simplify.h"
+#include "MeshOptimize.h"
 #include "bullet/btBulletCollisionCommon.h"
 #include "bullet/btBulletDynamicsCommon.h"
 #include "rapidxml/rapidxml.hpp"
 #include "nlohmann/json.hpp"
 #include "ZipFile.h"
+#include "AssetPack.h"
 #include <curl/curl.h>
 
 using namespace gmtl;
@@ -64,80 +66,390 @@ namespace sam
         std::vector<Vec3f> offsets;
     };
 
+    // Reads a mesh in the packed or the older float format, with positions
+    // negated to match the game's axes.  bounds is the range the vertices
+    // are packed to.
+    static bool ReadBrickMesh(const vecstream& ifs, std::vector<BrickVertex>& vertices,
+        std::vector<uint32_t>& indices, std::vector<uint16_t>& indices16, AABoxf& bounds)
+    {
+        BrickMeshHeader hdr = {};
+        ifs.read((char*)&hdr.magic, sizeof(hdr.magic));
+        bool hasHeader = hdr.magic == BrickMeshHeader::Magic;
+        if (hasHeader)
+            ifs.read((char*)&hdr.flags, sizeof(hdr) - sizeof(hdr.magic));
+        else
+            hdr.numvtx = hdr.magic;
+        if (hdr.numvtx == 0)
+            return false;
+
+        if (hdr.flags & MeshPacked)
+        {
+            vertices.resize(hdr.numvtx);
+            ifs.read((char*)vertices.data(), sizeof(BrickVertex) * hdr.numvtx);
+            // Negating the snorm values mirrors each vertex around the
+            // range's center, so the range is mirrored with them.
+            for (BrickVertex& vtx : vertices)
+            {
+                vtx.m_x = -vtx.m_x;
+                vtx.m_y = -vtx.m_y;
+                vtx.m_z = -vtx.m_z;
+                if (vtx.m_palette == 16)
+                    vtx.m_palette = BrickVertex::NoPalette;
+            }
+            bounds = AABoxf(
+                Point3f(-hdr.boundsMax[0], -hdr.boundsMax[1], -hdr.boundsMax[2]),
+                Point3f(-hdr.boundsMin[0], -hdr.boundsMin[1], -hdr.boundsMin[2]));
+        }
+        else
+        {
+            std::vector<PosTexcoordNrmVertex> floatVertices(hdr.numvtx);
+            ifs.read((char*)floatVertices.data(), sizeof(PosTexcoordNrmVertex) * hdr.numvtx);
+            bounds = AABoxf();
+            for (PosTexcoordNrmVertex& vtx : floatVertices)
+            {
+                vtx.m_y = -vtx.m_y;
+                vtx.m_x = -vtx.m_x;
+                vtx.m_z = -vtx.m_z;
+                if (vtx.m_u == 16)
+                    vtx.m_u = -1;
+                bounds += Vec3f(vtx.m_x, vtx.m_y, vtx.m_z);
+            }
+            float center[3], scale[3];
+            BrickPackRange(bounds.mMin.getData(), bounds.mMax.getData(), center, scale);
+            vertices.resize(hdr.numvtx);
+            for (size_t idx = 0; idx < floatVertices.size(); ++idx)
+            {
+                const PosTexcoordNrmVertex& vtx = floatVertices[idx];
+                vertices[idx] = PackBrickVertex(&vtx.m_x, &vtx.m_nx, vtx.m_u, center, scale);
+            }
+        }
+
+        if (!hasHeader)
+            ifs.read((char*)&hdr.numidx, sizeof(hdr.numidx));
+        if (hdr.flags & MeshIndex16)
+        {
+            indices16.resize(hdr.numidx);
+            ifs.read((char*)indices16.data(), sizeof(uint16_t) * hdr.numidx);
+            return true;
+        }
+        indices.resize(hdr.numidx);
+        ifs.read((char*)indices.data(), sizeof(uint32_t) * hdr.numidx);
+        // Older exports left unresolved indices as 0xFFFFFFFF, drop the
+        // triangles using them.
+        size_t count = 0;
+        for (size_t idx = 0; idx + 2 < indices.size(); idx += 3)
+        {
+            if (indices[idx] >= hdr.numvtx || indices[idx + 1] >= hdr.numvtx ||
+                indices[idx + 2] >= hdr.numvtx)
+                continue;
+            for (int k = 0; k < 3; ++k)
+                indices[count++] = indices[idx + k];
+        }
+        indices.resize(count);
+        // Older meshes are always 32 bit, narrow them when they fit.
+        if (hdr.numvtx < 0xFFFF)
+        {
+            indices16.assign(indices.begin(), indices.end());
+            indices.clear();
+            indices.shrink_to_fit();
+        }
+        return true;
+    }
+
+    static bgfx::IndexBufferHandle CreateIndexBuffer(const std::vector<uint32_t>& indices,
+        const std::vector<uint16_t>& indices16, size_t& bytes)
+    {
+        if (indices16.size() > 0)
+        {
+            bytes = indices16.size() * sizeof(uint16_t);
+            return bgfx::createIndexBuffer(bgfx::copy(indices16.data(), bytes));
+        }
+        bytes = indices.size() * sizeof(uint32_t);
+        return bgfx::createIndexBuffer(bgfx::copy(indices.data(), bytes), BGFX_BUFFER_INDEX32);
+    }
+
+    static void SetPackRange(const AABoxf& bounds, Vec4f range[2])
+    {
+        float center[3], scale[3];
+        BrickPackRange(bounds.mMin.getData(), bounds.mMax.getData(), center, scale);
+        range[0] = Vec4f(center[0], center[1], center[2], 0);
+        range[1] = Vec4f(scale[0], scale[1], scale[2], 0);
+    }
+
+    bool BrickMesh::Load(const vecstream& ifs, AABoxf& bounds)
+    {
+        if (!ReadBrickMesh(ifs, m_vertices, m_indices, m_indices16, bounds))
+            return false;
+        SetPackRange(bounds, m_packRange);
+        return true;
+    }
+
+    size_t BrickMesh::Upload()
+    {
+        if (m_vertices.size() == 0 ||
+            (m_indices.size() == 0 && m_indices16.size() == 0))
+            return 0;
+        BrickVertexLayout::init();
+        size_t vtxBytes = m_vertices.size() * sizeof(BrickVertex);
+        size_t idxBytes = 0;
+        // Copied, bgfx reads the data up to two frames later and CleanCache
+        // may free the brick before then.
+        m_vbh = bgfx::createVertexBuffer(bgfx::copy(m_vertices.data(), vtxBytes), BrickVertexLayout::ms_layout);
+        m_ibh = CreateIndexBuffer(m_indices, m_indices16, idxBytes);
+        return vtxBytes + idxBytes;
+    }
+
+    const BrickMesh* Brick::DrawMesh(BrickDetail detail) const
+    {
+        if (m_meshes[detail].m_vbh.isValid())
+            return &m_meshes[detail];
+        if (m_meshes[DetailLores].m_vbh.isValid())
+            return &m_meshes[DetailLores];
+        return nullptr;
+    }
+
     void Brick::LoadLores(const vecstream& ifs)
     {
-        PosTexcoordNrmVertex::init();
-        uint32_t numvtx = 0;
-        uint32_t numidx = 0;
-        ifs.read((char*)&numvtx, sizeof(numvtx));
-        if (numvtx == 0)
+        AABoxf bounds;
+        if (!m_meshes[DetailLores].Load(ifs, bounds))
             return;
-        m_verticesLR.resize(numvtx);
-        ifs.read((char*)m_verticesLR.data(), sizeof(PosTexcoordNrmVertex) * numvtx);
-        ifs.read((char*)&numidx, sizeof(numidx));
-        m_indicesLR.resize(numidx);
-        ifs.read((char*)m_indicesLR.data(), sizeof(uint32_t) * numidx);
-
-        PosTexcoordNrmVertex* curVtx = m_verticesLR.data();
-        PosTexcoordNrmVertex* endVtx = curVtx + numvtx;
-        for (; curVtx != endVtx; ++curVtx)
-        {
-            curVtx->m_y = -curVtx->m_y;
-            curVtx->m_x = -curVtx->m_x;
-            curVtx->m_z = -curVtx->m_z;
-            if (curVtx->m_u == 16)
-                curVtx->m_u = -1;
-            m_bounds += Vec3f(curVtx->m_x, curVtx->m_y, curVtx->m_z);
-        }
+
+        m_bounds = bounds;
         Vec3f ext = m_bounds.mMax - m_bounds.mMin;
         m_scale = std::max(std::max(ext[0], ext[1]), ext[2]);
         m_center = (m_bounds.mMax + m_bounds.mMin) * 0.5f;
 
         m_collisionBox = m_bounds;
 
-        Vec3f bnd = m_bounds.mMax - m_bounds.mMin;
-        Vec3f col = m_collisionBox.mMax - m_collisionBox.mMin;
-
         //LoadConnectors(pLoader, name);
-        m_vbhLR = bgfx::createVertexBuffer(bgfx::makeRef(m_verticesLR.data(), m_verticesLR.size() * sizeof(PosTexcoordNrmVertex)), PosTexcoordNrmVertex::ms_layout);
-        m_ibhLR = bgfx::createIndexBuffer(bgfx::makeRef(m_indicesLR.data(), m_indicesLR.size() * sizeof(uint32_t)), BGFX_BUFFER_INDEX32);
     }
 
-    void Brick::LoadHires(const vecstream& ifs)
+    static const char* MeshExtension(BrickDetail detail)
+    {
+        static const char* extensions[NumDetails] = {
+            ".hr_mesh", ".lr_mesh", ".lod1_mesh", ".lod2_mesh", ".lod3_mesh" };
+        return extensions[detail];
+    }
+
+    // Fraction of the lores triangles each Lod level keeps.
+    static const float LodRatios[] = { 0.5f, 0.2f, 0.05f };
+    // LDraw stud height.
+    static const float StudHeight = 4.0f;
+
+    struct LodTri
+    {
+        uint32_t v[3];
+        uint8_t palette;
+    };
+
+    // Studs stand StudHeight above the top of a part.  When the faces at the
+    // very top cover well under the part's footprint they are taken to be
+    // stud tops, and everything above the plane the studs stand on goes.
+    // Tiles and other flat topped parts keep their top.
+    static void RemoveStuds(const std::vector<Vec3f>& positions, std::vector<LodTri>& tris)
+    {
+        AABoxf bounds;
+        for (const LodTri& t : tris)
+            for (uint32_t v : t.v)
+                bounds += positions[v];
+        float top = bounds.mMax[1];
+        float footprint = (bounds.mMax[0] - bounds.mMin[0]) * (bounds.mMax[2] - bounds.mMin[2]);
+        const float eps = 0.01f;
+        float topArea = 0;
+        for (const LodTri& t : tris)
+        {
+            const Vec3f& p0 = positions[t.v[0]];
+            const Vec3f& p1 = positions[t.v[1]];
+            const Vec3f& p2 = positions[t.v[2]];
+            if (std::abs(p0[1] - top) > eps || std::abs(p1[1] - top) > eps ||
+                std::abs(p2[1] - top) > eps)
+                continue;
+            topArea += std::abs((p1[0] - p0[0]) * (p2[2] - p0[2]) -
+                (p2[0] - p0[0]) * (p1[2] - p0[2])) * 0.5f;
+        }
+        if (topArea == 0 || topArea > footprint * 0.5f)
+            return;
+
+        float studBase = top - StudHeight;
+        tris.erase(std::remove_if(tris.begin(), tris.end(), [&](const LodTri& t)
+            {
+                bool above = false;
+                for (uint32_t v : t.v)
+                {
+                    float y = positions[v][1];
+                    if (y < studBase - eps)
+                        return false;
+                    above |= y > studBase + eps;
+                }
+                return above;
+            }), tris.end());
+    }
+
+    // Simplify.h keeps the mesh it works on in globals.
+    static std::mutex sSimplifyMtx;
+
+    static void SimplifyLod(std::vector<Vec3f>& positions, std::vector<LodTri>& tris, size_t target)
+    {
+        std::lock_guard<std::mutex> lock(sSimplifyMtx);
+        Simplify::vertices.resize(positions.size());
+        for (size_t idx = 0; idx < positions.size(); ++idx)
+            Simplify::vertices[idx].p = vec3f(positions[idx][0], positions[idx][1], positions[idx][2]);
+        Simplify::triangles.clear();
+        for (const LodTri& lt : tris)
+        {
+            Simplify::Triangle t = {};
+            for (int k = 0; k < 3; ++k)
+                t.v[k] = (int)lt.v[k];
+            t.material = lt.palette;
+            Simplify::triangles.push_back(t);
+        }
+        Simplify::simplify_mesh((int)target);
+
+        positions.resize(Simplify::vertices.size());
+        for (size_t idx = 0; idx < positions.size(); ++idx)
+        {
+            const vec3f& p = Simplify::vertices[idx].p;
+            positions[idx] = Vec3f((float)p.x, (float)p.y, (float)p.z);
+        }
+        tris.clear();
+        for (const Simplify::Triangle& t : Simplify::triangles)
+        {
+            if (t.deleted)
+                continue;
+            tris.push_back(LodTri{ { (uint32_t)t.v[0], (uint32_t)t.v[1], (uint32_t)t.v[2] },
+                (uint8_t)t.material });
+        }
+    }
+
+    // Writes tris in the packed mesh format, undoing the negation
+    // ReadBrickMesh applies.  Corners with the same position, face normal
+    // and palette share a vertex, ordered the way exported meshes are.
+    static std::vector<uint8_t> WriteLodMesh(const std::vector<Vec3f>& positions,
+        const std::vector<LodTri>& tris)
     {
-        uint32_t numvtx = 0;
-        uint32_t numidx = 0;
-        ifs.read((char*)&numvtx, sizeof(numvtx));
-        if (numvtx == 0)
+        BrickMeshHeader hdr = {};
+        hdr.magic = BrickMeshHeader::Magic;
+        AABoxf bounds;
+        for (const LodTri& t : tris)
+            for (uint32_t v : t.v)
+                bounds += Vec3f(-positions[v]);
+        for (int i = 0; i < 3; ++i)
+        {
+            hdr.boundsMin[i] = bounds.mMin[i];
+            hdr.boundsMax[i] = bounds.mMax[i];
+        }
+        float center[3], scale[3];
+        BrickPackRange(hdr.boundsMin, hdr.boundsMax, center, scale);
+
+        std::vector<BrickVertex> vertices;
+        std::vector<uint32_t> indices;
+        indices.reserve(tris.size() * 3);
+        std::map<std::tuple<uint32_t, uint8_t, uint8_t, uint8_t>, uint32_t> shared;
+        for (const LodTri& t : tris)
+        {
+            // Negating both edges leaves the normal as it was.
+            const Vec3f& p0 = positions[t.v[0]];
+            Vec3f n;
+            cross(n, Vec3f(positions[t.v[1]] - p0), Vec3f(positions[t.v[2]] - p0));
+            normalize(n);
+            for (uint32_t v : t.v)
+            {
+                Vec3f p = -positions[v];
+                BrickVertex vtx = PackBrickVertex(p.getData(), n.getData(), t.palette, center, scale);
+                auto it = shared.insert(std::make_pair(
+                    std::make_tuple(v, vtx.m_nu, vtx.m_nv, vtx.m_palette), (uint32_t)vertices.size()));
+                if (it.second)
+                    vertices.push_back(vtx);
+                indices.push_back(it.first->second);
+            }
+        }
+        OptimizeVertexCache(indices, (uint32_t)vertices.size());
+        OptimizeVertexFetch(vertices, indices);
+        hdr.numvtx = (uint32_t)vertices.size();
+        hdr.numidx = (uint32_t)indices.size();
+        bool index16 = hdr.numvtx < 0xFFFF;
+        hdr.flags = MeshPacked | (index16 ? MeshIndex16 : 0);
+
+        std::vector<uint8_t> data;
+        auto append = [&data](const void* ptr, size_t size)
+            { data.insert(data.end(), (const uint8_t*)ptr, (const uint8_t*)ptr + size); };
+        append(&hdr, sizeof(hdr));
+        append(vertices.data(), vertices.size() * sizeof(BrickVertex));
+        if (index16)
+        {
+            std::vector<uint16_t> indices16(indices.begin(), indices.end());
+            append(indices16.data(), indices16.size() * sizeof(uint16_t));
+        }
+        else
+            append(indices.data(), indices.size() * sizeof(uint32_t));
+        return data;
+    }
+
+    // AssetPack::DeriveFn adding the Lod meshes of each lores mesh.
+    static void GenerateBrickLods(const std::string& name, const vecstream& data,
+        std::vector<std::pair<std::string, std::vector<uint8_t>>>& derived)
+    {
+        const std::string lrExt = MeshExtension(DetailLores);
+        if (name.size() <= lrExt.size() ||
+            name.compare(name.size() - lrExt.size(), lrExt.size(), lrExt) != 0)
             return;
-        m_verticesHR.resize(numvtx);
-        ifs.read((char*)m_verticesHR.data(), sizeof(PosTexcoordNrmVertex) * numvtx);
-        ifs.read((char*)&numidx, sizeof(numidx));
-        m_indicesHR.resize(numidx);
-        ifs.read((char*)m_indicesHR.data(), sizeof(uint32_t) * numidx);
-        /*
-        for (size_t idx = 0; idx < m_indicesHR.size(); idx += 3)
-        {
-            uint32_t tmp = m_indicesHR[idx];
-            m_indicesHR[idx] = m_indicesHR[idx + 2];
-            m_indicesHR[idx + 2] = tmp;
-        }*/
-        PosTexcoordNrmVertex* curVtx = m_verticesHR.data();
-        PosTexcoordNrmVertex* endVtx = curVtx + numvtx;
-        for (; curVtx != endVtx; ++curVtx)
-        {
-            curVtx->m_y = -curVtx->m_y;
-            curVtx->m_x = -curVtx->m_x;
-            curVtx->m_z = -curVtx->m_z;
-            if (curVtx->m_u == 16)
-                curVtx->m_u = -1;
-        }
-        if (m_verticesHR.size() == 0 ||
-            m_indicesHR.size() == 0)
+        BrickMesh mesh;
+        AABoxf bounds;
+        if (!mesh.Load(data, bounds))
             return;
+        std::vector<uint32_t> indices = mesh.m_indices;
+        if (mesh.m_indices16.size() > 0)
+            indices.assign(mesh.m_indices16.begin(), mesh.m_indices16.end());
 
-        m_vbhHR = bgfx::createVertexBuffer(bgfx::makeRef(m_verticesHR.data(), m_verticesHR.size() * sizeof(PosTexcoordNrmVertex)), PosTexcoordNrmVertex::ms_layout);
-        m_ibhHR = bgfx::createIndexBuffer(bgfx::makeRef(m_indicesHR.data(), m_indicesHR.size() * sizeof(uint32_t)), BGFX_BUFFER_INDEX32);
+        // Weld vertices the exporter split for normals, or Simplify treats
+        // every hard edge as a border it can't collapse.
+        std::map<std::tuple<int16_t, int16_t, int16_t>, uint32_t> welded;
+        std::vector<uint32_t> remap(mesh.m_vertices.size());
+        std::vector<Vec3f> positions;
+        const Vec4f* range = mesh.m_packRange;
+        for (size_t idx = 0; idx < mesh.m_vertices.size(); ++idx)
+        {
+            const BrickVertex& v = mesh.m_vertices[idx];
+            auto it = welded.insert(std::make_pair(std::make_tuple(v.m_x, v.m_y, v.m_z),
+                (uint32_t)positions.size()));
+            if (it.second)
+            {
+                positions.push_back(Vec3f(
+                    range[0][0] + v.m_x / 32767.0f * range[1][0],
+                    range[0][1] + v.m_y / 32767.0f * range[1][1],
+                    range[0][2] + v.m_z / 32767.0f * range[1][2]));
+            }
+            remap[idx] = it.first->second;
+        }
+        std::vector<LodTri> tris;
+        for (size_t idx = 0; idx + 2 < indices.size(); idx += 3)
+        {
+            if (indices[idx] >= remap.size() || indices[idx + 1] >= remap.size() ||
+                indices[idx + 2] >= remap.size())
+                continue;
+            LodTri t = { { remap[indices[idx]], remap[indices[idx + 1]], remap[indices[idx + 2]] },
+                mesh.m_vertices[indices[idx]].m_palette };
+            if (t.v[0] != t.v[1] && t.v[1] != t.v[2] && t.v[0] != t.v[2])
+                tris.push_back(t);
+        }
+        if (tris.size() == 0)
+            return;
+
+        size_t lrTris = tris.size();
+        std::string base = name.substr(0, name.size() - lrExt.size());
+        // Each level is simplified from the one before.
+        for (int lod = 0; lod < 3; ++lod)
+        {
+            if (lod == 2)
+                RemoveStuds(positions, tris);
+            size_t target = std::max((size_t)(lrTris * LodRatios[lod]), (size_t)12);
+            if (tris.size() > target)
+                SimplifyLod(positions, tris, target);
+            if (tris.size() == 0)
+                break;
+            derived.push_back(std::make_pair(base + MeshExtension((BrickDetail)(DetailLod1 + lod)),
+                WriteLodMesh(positions, tris)));
+        }
     }
 
     bool Brick::LoadCollisionMesh(const vecstream& stream)
@@ -260,18 +572,47 @@ namespace sam
     constexpr int iconH = 256;
     static BrickManager* spMgr = nullptr;
     BrickManager::BrickManager() :
-        m_mruCtr(0)
+        m_mruCtr(0),
+        m_exit(false)
     {
         spMgr = this;
         m_cachePath = Application::Inst().Documents() + "/cache.zip";
         DownloadCacheFile();
         LoadColors();
         LoadAllParts();
+        // Decoding is pure CPU work, leave a core for the render thread and
+        // the rest to the tile loaders.
+        int numDecoders = std::clamp((int)std::thread::hardware_concurrency() / 2, 1, 4);
+        for (int idx = 0; idx < numDecoders; ++idx)
+            m_decodeThreads.push_back(std::thread(DecodeThread, this));
     }
 
     BrickManager::~BrickManager()
     {
+        {
+            std::lock_guard grd(m_decodeMtx);
+            m_exit = true;
+        }
+        m_decodeCv.notify_all();
+        for (auto& thread : m_decodeThreads)
+            thread.join();
+    }
 
+    void BrickManager::DecodeThread(void* arg)
+    {
+        BrickManager* pThis = (BrickManager*)arg;
+        std::unique_lock<std::mutex> lk(pThis->m_decodeMtx);
+        while (true)
+        {
+            pThis->m_decodeCv.wait(lk, [pThis]() { return pThis->m_exit || pThis->m_decodeJobs.size() > 0; });
+            if (pThis->m_exit)
+                break;
+            DecodeJob job = std::move(pThis->m_decodeJobs.front());
+            pThis->m_decodeJobs.pop_front();
+            lk.unlock();
+            pThis->Decode(job);
+            lk.lock();
+        }
     }
 
     // trim from start (in place)
@@ -282,7 +623,7 @@ namespace sam
     }
     void BrickManager::LoadConnectors(Brick* pBrick)
     {
-        vecstream stream = m_cacheZip->ReadFile(pBrick->m_name.Name() + ".json");
+        vecstream stream = ReadAsset(pBrick->m_name.Name() + ".json");
         //if (pBrick->m_name == "3814")
         //  __debugbreak();
         if (stream.valid())
@@ -291,7 +632,7 @@ namespace sam
 
     bool BrickManager::LoadCollision(Brick* pBrick)
     {
-        vecstream stream = m_cacheZip->ReadFile(pBrick->m_name.Name() + ".col");
+        vecstream stream = ReadAsset(pBrick->m_name.Name() + ".col");
         if (stream.valid())
             return pBrick->LoadCollisionMesh(stream);
         return false;
@@ -375,8 +716,36 @@ namespace sam
             delete pwf;
         }
 
+        std::filesystem::path packPath = m_cachePath;
+        packPath.replace_extension(".pack");
+        std::error_code ec;
+        bool built = false;
+        auto buildPack = [&]()
+        {
+            ZipFile zip(m_cachePath.string());
+            AssetPack::Build(zip, packPath.string(), GenerateBrickLods);
+            built = true;
+        };
+        if (!std::filesystem::exists(packPath) ||
+            std::filesystem::last_write_time(packPath, ec) < std::filesystem::last_write_time(m_cachePath, ec))
+            buildPack();
+        m_assets = std::make_shared<AssetPack>();
+        // A pack from an older version is rebuilt.
+        if (!m_assets->Open(packPath.string()) && !built)
+        {
+            buildPack();
+            m_assets->Open(packPath.string());
+        }
+        if (!m_assets->IsOpen())
+            m_cacheZip = std::make_shared<ZipFile>(m_cachePath.string());
+    }
 
-        m_cacheZip = std::make_shared<ZipFile>(m_cachePath.string());
+    vecstream BrickManager::ReadAsset(const std::string& name) const
+    {
+        if (m_assets->IsOpen())
+            return m_assets->ReadFile(name);
+        std::lock_guard<std::mutex> lock(m_zipMtx);
+        return m_cacheZip->ReadFile(name);
     }
 
     void BrickManager::LoadAllParts()
@@ -391,7 +760,7 @@ namespace sam
 
         std::map<std::string, std::string> categories;
         {
-            vecstream str = m_cacheZip->ReadFile("categories.json");
+            vecstream str = ReadAsset("categories.json");
 
             json jobj = json::parse(str.readText());
             for (auto& [key, value] : jobj.items()) {
@@ -434,6 +803,7 @@ namespace sam
 
     static bgfx::ProgramHandle sShader(BGFX_INVALID_HANDLE);
     static bgfxh<bgfx::UniformHandle> sUparams;
+    static bgfxh<bgfx::UniformHandle> sMeshBounds;
 
     void BrickManager::Draw(DrawContext& ctx)
     {
@@ -441,6 +811,8 @@ namespace sam
             sShader = Engine::Inst().LoadShader("vs_brickpreview.bin", "fs_brickpreview.bin");
         if (!sUparams.isValid())
             sUparams = bgfx::createUniform("u_params", bgfx::UniformType::Vec4, 1);
+        if (!sMeshBounds.isValid())
+            sMeshBounds = bgfx::createUniform("u_meshBounds", bgfx::UniformType::Vec4, 2);
 
         if (!m_paletteHandle.isValid())
             m_paletteHandle = bgfx::createUniform("s_brickPalette", bgfx::UniformType::Sampler);
@@ -457,13 +829,16 @@ namespace sam
                 );
         }
 
+        UploadDecoded();
+
         Vec4f color = Vec4f(15, 0, 0, 0);
         PosTexcoordNrmVertex::init();
         std::vector<std::shared_ptr<Brick>> brickRenderQueue;
         std::swap(brickRenderQueue, m_brickRenderQueue);
         for (auto& brick : brickRenderQueue)
         {
-            if (!brick->m_vbhLR.isValid())
+            const BrickMesh& mesh = brick->m_meshes[DetailLores];
+            if (!mesh.m_vbh.isValid())
                 continue;
             brick->m_icon =
                 bgfx::createTexture2D(
@@ -487,6 +862,7 @@ namespace sam
             gmtl::identity(view);
             gmtl::identity(proj);
             bgfx::setUniform(sUparams, &color, 1);
+            bgfx::setUniform(sMeshBounds, mesh.m_packRange, 2);
             bgfx::setViewRect(viewId, 0, 0, bgfx::BackbufferRatio::Equal);
             bgfx::setViewTransform(viewId, view.getData(), proj.getData());
             bgfx::setViewClear(viewId,
@@ -517,8 +893,8 @@ namespace sam
 
             bgfx::setTexture(0, m_paletteHandle, m_colorPalette);
             bgfx::setState(state);
-            bgfx::setVertexBuffer(0, brick->m_vbhLR);
-            bgfx::setIndexBuffer(brick->m_ibhLR);
+            bgfx::setVertexBuffer(0, mesh.m_vbh);
+            bgfx::setIndexBuffer(mesh.m_ibh);
             bgfx::submit(viewId, sShader);
         }
     }
@@ -534,33 +910,103 @@ namespace sam
     BrickManager& BrickManager::Inst() { return *spMgr; }
 
     size_t g_brickCacheCnt = 0;
-    std::shared_ptr<Brick> BrickManager::GetBrick(const PartId& name, bool hires)
+    BrickManager::BrickFuture BrickManager::GetBrickAsync(const PartId& name, BrickDetail detail)
+    {
+        return RequestBrick(name, detail, false);
+    }
+
+    std::shared_ptr<Brick> BrickManager::GetBrick(const PartId& name, BrickDetail detail)
+    {
+        return RequestBrick(name, detail, true).Get();
+    }
+
+    BrickManager::BrickFuture BrickManager::RequestBrick(const PartId& name, BrickDetail detail, bool decodeHere)
     {
-        auto itBrick = m_bricks.find(name);
-        if (itBrick == m_bricks.end())
+        BrickFuture result;
+        std::vector<DecodeJob> jobs;
         {
-            itBrick = m_bricks.insert(std::make_pair(name,
-                std::make_shared<Brick>(name))).first;
+            std::lock_guard<std::mutex> lock(m_cacheMtx);
+            auto itBrick = m_bricks.find(name);
+            if (itBrick == m_bricks.end())
+            {
+                itBrick = m_bricks.insert(std::make_pair(name,
+                    std::make_shared<Brick>(name))).first;
+            }
+            std::shared_ptr<Brick> b = itBrick->second;
+            // Other details wait on the lores job, so it goes in first.
+            for (BrickDetail d : { DetailLores, detail })
+            {
+                BrickMesh& mesh = b->m_meshes[d];
+                if (mesh.m_decoded.valid())
+                    continue;
+                DecodeJob job{ b, d };
+                mesh.m_decoded = job.done.get_future().share();
+                jobs.push_back(std::move(job));
+            }
+            result.brick = b;
+            result.decoded = b->m_meshes[detail].m_decoded;
+            g_brickCacheCnt = m_bricks.size();
         }
-        std::shared_ptr<Brick> b = itBrick->second;
-        if (!b->m_vbhLR.isValid())
+        MruUpdate(result.brick.get());
+
+        if (decodeHere)
         {
-            std::string lores = name.GetFilename() + ".lr_mesh";
-            vecstream stream = m_cacheZip->ReadFile(lores);
-            if (stream.valid())
-                b->LoadLores(stream);
+            for (DecodeJob& job : jobs)
+                Decode(job);
         }
-        if (hires && (!b->m_vbhHR.isValid()))
+        else if (jobs.size() > 0)
         {
-            std::string hires = name.GetFilename() + ".hr_mesh";
-            vecstream stream = m_cacheZip->ReadFile(hires);
-            if (stream.valid())
-                b->LoadHires(stream);
+            {
+                std::lock_guard<std::mutex> lock(m_decodeMtx);
+                for (DecodeJob& job : jobs)
+                    m_decodeJobs.push_back(std::move(job));
+            }
+            m_decodeCv.notify_all();
         }
-        MruUpdate(b.get());
-        g_brickCacheCnt = m_bricks.size();
         CleanCache();
-        return b;
+        return result;
+    }
+
+    void BrickManager::Decode(DecodeJob& job)
+    {
+        Brick* b = job.brick.get();
+        // Other details don't touch the lores mesh, but callers expect its
+        // bounds, and it is drawn in their place until they are uploaded.
+        if (job.detail != DetailLores)
+            b->m_meshes[DetailLores].m_decoded.wait();
+        std::string file = b->m_name.GetFilename() + MeshExtension(job.detail);
+        vecstream stream = ReadAsset(file);
+        if (stream.valid())
+        {
+            if (job.detail == DetailLores)
+                b->LoadLores(stream);
+            else
+            {
+                AABoxf bounds;
+                b->m_meshes[job.detail].Load(stream, bounds);
+            }
+            std::lock_guard<std::mutex> lock(m_uploadMtx);
+            m_uploads.push_back(Upload{ job.brick, job.detail });
+        }
+        job.done.set_value();
+    }
+
+    void BrickManager::UploadDecoded()
+    {
+        // Always make some progress, even on a mesh larger than the budget.
+        size_t bytes = 0;
+        while (bytes < UploadBudget)
+        {
+            Upload upload;
+            {
+                std::lock_guard<std::mutex> lock(m_uploadMtx);
+                if (m_uploads.size() == 0)
+                    break;
+                upload = std::move(m_uploads.front());
+                m_uploads.pop_front();
+            }
+            bytes += upload.brick->m_meshes[upload.detail].Upload();
+        }
     }
 
     bgfx::TextureHandle BrickManager::GetBrickThumbnail(const PartId& name)
@@ -578,8 +1024,6 @@ namespace sam
 
     void BrickManager::CleanCache()
     {
-        if (m_bricks.size() < 512)
-            return;
         std::lock_guard<std::mutex> lock(m_cacheMtx);
         if (m_bricks.size() < 512)
             return;
@@ -5,6 +5,11 @@
 #include <list>
 #include <filesystem>
 #include <mutex>
+#include <deque>
+#include <future>
+#include <thread>
+#include <atomic>
+#include <condition_variable>
 #include "SceneItem.h"
 #include "Engine.h"
 #include "ConnectionLogic.h"
@@ -12,6 +17,7 @@
 #include "Loc.h"
 #include "PartDefs.h"
 #include "Mesh.h"
+#include "BrickVertex.h"
 #include "indexed_map.h"
 
 struct CubeList;
@@ -29,6 +35,7 @@ namespace sam
 namespace sam
 {       
     class ZipFile;
+    class AssetPack;
     class vecstream;
     struct PartDesc
     {
@@ -62,24 +69,48 @@ namespace sam
         return lhs.desc < rhs.desc;
     }
 
+    // Mesh detail levels, finest first.  The Lod levels are simplified from
+    // the lores mesh when the asset pack is built, Lod3 without studs.
+    enum BrickDetail : int
+    {
+        DetailHires,
+        DetailLores,
+        DetailLod1,
+        DetailLod2,
+        DetailLod3,
+        NumDetails
+    };
+
+    struct BrickMesh
+    {
+        std::vector<BrickVertex> m_vertices;
+        std::vector<uint32_t> m_indices;
+        // Used instead of m_indices when every index fits.
+        std::vector<uint16_t> m_indices16;
+        bgfxh<bgfx::VertexBufferHandle> m_vbh;
+        bgfxh<bgfx::IndexBufferHandle> m_ibh;
+        // Center and half extent the vertices are packed to, for u_meshBounds.
+        Vec4f m_packRange[2];
+        // Ready once the mesh is decoded.  The GPU buffers are created later
+        // on the render thread, until then the handles are invalid.
+        std::shared_future<void> m_decoded;
+
+        bool Load(const vecstream& data, AABoxf& bounds);
+        // Creates the buffers for the decoded mesh, returns the bytes uploaded.
+        size_t Upload();
+    };
+
     struct Brick
     {
         PartId m_name;
-        std::vector<PosTexcoordNrmVertex> m_verticesLR;
-        std::vector<uint32_t> m_indicesLR;
-        bgfxh<bgfx::VertexBufferHandle> m_vbhLR;
-        bgfxh<bgfx::IndexBufferHandle> m_ibhLR;
-
-        std::vector<PosTexcoordNrmVertex> m_verticesHR;
-        std::vector<uint32_t> m_indicesHR;
-        bgfxh<bgfx::VertexBufferHandle> m_vbhHR;
-        bgfxh<bgfx::IndexBufferHandle> m_ibhHR;
+        BrickMesh m_meshes[NumDetails];
 
         AABoxf m_bounds;
         AABoxf m_collisionBox;
         float m_scale;
         bgfxh<bgfx::TextureHandle> m_icon;
-        size_t m_mruCtr;
+        // Touched from the loader, decode and render threads.
+        std::atomic<size_t> m_mruCtr;
         Vec3f m_center;
         bool m_connectorsLoaded;
         std::vector<Connector> m_connectors;
@@ -92,10 +123,13 @@ namespace sam
             m_connectorsLoaded(false),
             m_scale(0),
             m_mruCtr(0) {}
+
+        // The lores mesh stands in while detail isn't uploaded, or if the
+        // part has no such mesh.  Null if neither is ready.
+        const BrickMesh* DrawMesh(BrickDetail detail) const;
     private:
         void LoadLores(
             const vecstream &data);
-        void LoadHires(const vecstream& data);
         void LoadConnectors(const vecstream &stream);
         bool LoadCollisionMesh(const vecstream& stream);
         friend class BrickManager;
@@ -126,7 +160,24 @@ namespace sam
         static constexpr float Scale = 1 / 20.0f;
 
         static BrickManager& Inst();
-        std::shared_ptr<Brick> GetBrick(const PartId& name, bool hires = false);
+
+        struct BrickFuture
+        {
+            std::shared_ptr<Brick> brick;
+            std::shared_future<void> decoded;
+
+            bool IsReady() const
+            { return decoded.wait_for(std::chrono::seconds(0)) == std::future_status::ready; }
+            std::shared_ptr<Brick> Get() const
+            { decoded.wait(); return brick; }
+        };
+
+        // Decodes the brick on the decode threads.  Its buffers are created
+        // in Draw, at most UploadBudget bytes worth a frame.
+        BrickFuture GetBrickAsync(const PartId& name, BrickDetail detail = DetailLores);
+        // Waits for the decode, which runs on the calling thread if nothing
+        // else has asked for the brick yet.
+        std::shared_ptr<Brick> GetBrick(const PartId& name, BrickDetail detail = DetailLores);
         bgfx::TextureHandle GetBrickThumbnail(const PartId& name);
         BrickManager();
         ~BrickManager();
@@ -191,7 +242,27 @@ namespace sam
         void LoadAllParts();
         void DownloadCacheFile();
         void CleanCache();
+        vecstream ReadAsset(const std::string& name) const;
 
+        struct DecodeJob
+        {
+            std::shared_ptr<Brick> brick;
+            BrickDetail detail;
+            std::promise<void> done;
+        };
+        struct Upload
+        {
+            std::shared_ptr<Brick> brick;
+            BrickDetail detail;
+        };
+        static constexpr size_t UploadBudget = 4 << 20;
+
+        BrickFuture RequestBrick(const PartId& name, BrickDetail detail, bool decodeHere);
+        void Decode(DecodeJob& job);
+        static void DecodeThread(void* arg);
+        void UploadDecoded();
+
+        // Guarded by m_cacheMtx.
         std::map<PartId, std::shared_ptr<Brick>> m_bricks;
         bgfxh<bgfx::UniformHandle> m_paletteHandle;
         index_map<PartId, PartDesc> m_partsMap;
@@ -201,9 +272,23 @@ namespace sam
         std::vector<std::shared_ptr<Brick>> m_brickRenderQueue;
         bgfxh<bgfx::TextureHandle> m_iconDepth;
         bgfxh<bgfx::TextureHandle> m_colorPalette;
-        size_t m_mruCtr;
+        std::atomic<size_t> m_mruCtr;
         index_map<int, BrickColor> m_colors;
         std::map<std::string, std::string> m_aliasParts;
+        // Parts are read from the pack built from cache.zip, the zip is only
+        // kept open if that fails.
+        std::shared_ptr<AssetPack> m_assets;
         std::shared_ptr<ZipFile> m_cacheZip;
+        mutable std::mutex m_zipMtx;
+
+        // Decode jobs run in order, so any other detail's job always finds
+        // its lores job already taken.
+        std::deque<DecodeJob> m_decodeJobs;
+        std::vector<std::thread> m_decodeThreads;
+        std::mutex m_decodeMtx;
+        std::condition_variable m_decodeCv;
+        bool m_exit;
+        std::mutex m_uploadMtx;
+        std::deque<Upload> m_uploads;
     };
 }
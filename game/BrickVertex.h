@@ -0,0 +1,105 @@
+#pragma once
+
+#include <cstdint>
+#include <cmath>
+#include <algorithm>
+
+// Packed brick mesh format, shared by the game and the partmake exporter so
+// it has no engine dependencies.
+namespace sam
+{
+    enum BrickMeshFlags : uint32_t
+    {
+        // Vertices are BrickVertex rather than PosTexcoordNrmVertex.
+        MeshPacked = 1,
+        // Indices are uint16_t rather than uint32_t.
+        MeshIndex16 = 2
+    };
+
+    // Starts .lr_mesh and .hr_mesh files.  Older files have no header and
+    // begin with their vertex count, which never reaches Magic.
+    struct BrickMeshHeader
+    {
+        static constexpr uint32_t Magic = 0x4853454D; // "MESH"
+
+        uint32_t magic;
+        uint32_t flags;
+        uint32_t numvtx;
+        uint32_t numidx;
+        // Range the positions are quantized to.
+        float boundsMin[3];
+        float boundsMax[3];
+    };
+
+    // 12 byte brick vertex.  The position is snorm16 within the mesh bounds
+    // (w is padding), the normal is octahedral encoded in two unorm8s.
+    struct BrickVertex
+    {
+        // Takes the color of the part instance.
+        static constexpr uint8_t NoPalette = 255;
+
+        int16_t m_x;
+        int16_t m_y;
+        int16_t m_z;
+        int16_t m_w;
+        uint8_t m_nu;
+        uint8_t m_nv;
+        uint8_t m_palette;
+        uint8_t m_pad;
+    };
+    static_assert(sizeof(BrickVertex) == 12, "BrickVertex must stay packed");
+
+    // Center and half extent positions are packed relative to.  Flat axes
+    // get a tiny extent so decoding doesn't divide by zero.
+    inline void BrickPackRange(const float mn[3], const float mx[3], float center[3], float scale[3])
+    {
+        for (int i = 0; i < 3; ++i)
+        {
+            center[i] = (mn[i] + mx[i]) * 0.5f;
+            scale[i] = (std::max)((mx[i] - mn[i]) * 0.5f, 1e-6f);
+        }
+    }
+
+    inline int16_t QuantizeSnorm16(float v)
+    {
+        return (int16_t)std::lround(std::clamp(v, -1.0f, 1.0f) * 32767.0f);
+    }
+
+    inline uint8_t QuantizeUnorm8(float v)
+    {
+        return (uint8_t)std::lround(std::clamp(v, 0.0f, 1.0f) * 255.0f);
+    }
+
+    // Inverse of OctDecode in shaders/brick.sh.
+    inline void OctEncode(const float n[3], uint8_t& u, uint8_t& v)
+    {
+        float len = std::abs(n[0]) + std::abs(n[1]) + std::abs(n[2]);
+        float ox = len > 0 ? n[0] / len : 0;
+        float oy = len > 0 ? n[1] / len : 0;
+        if (n[2] < 0)
+        {
+            float fx = (1 - std::abs(oy)) * (ox >= 0 ? 1.0f : -1.0f);
+            float fy = (1 - std::abs(ox)) * (oy >= 0 ? 1.0f : -1.0f);
+            ox = fx;
+            oy = fy;
+        }
+        u = QuantizeUnorm8(ox * 0.5f + 0.5f);
+        v = QuantizeUnorm8(oy * 0.5f + 0.5f);
+    }
+
+    // palette is the float index exported meshes carry, negative for none.
+    inline BrickVertex PackBrickVertex(const float pos[3], const float nrm[3], float palette,
+        const float center[3], const float scale[3])
+    {
+        BrickVertex v;
+        v.m_x = QuantizeSnorm16((pos[0] - center[0]) / scale[0]);
+        v.m_y = QuantizeSnorm16((pos[1] - center[1]) / scale[1]);
+        v.m_z = QuantizeSnorm16((pos[2] - center[2]) / scale[2]);
+        v.m_w = 0;
+        OctEncode(nrm, v.m_nu, v.m_nv);
+        v.m_palette = (palette < 0 || palette >= BrickVertex::NoPalette) ?
+            BrickVertex::NoPalette : (uint8_t)palette;
+        v.m_pad = 0;
+        return v;
+    }
+}
\ No newline at end of file
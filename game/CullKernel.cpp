@@ -0,0 +1,198 @@
+#include "CullKernel.h"
+#include <algorithm>
+#include <cmath>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define SAM_CULL_SSE
+#include <emmintrin.h>
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#define SAM_CULL_NEON
+#include <arm_neon.h>
+#endif
+
+using namespace gmtl;
+
+namespace sam
+{
+    void OctantBoxes::SetChildren(const Loc& parent)
+    {
+        for (int idx = 0; idx < 8; ++idx)
+        {
+            AABoxf box = parent.GetChild(idx).GetBBox();
+            minx[idx] = box.mMin[0];
+            miny[idx] = box.mMin[1];
+            minz[idx] = box.mMin[2];
+            maxx[idx] = box.mMax[0];
+            maxy[idx] = box.mMax[1];
+            maxz[idx] = box.mMax[2];
+        }
+    }
+
+    // For each box the frustum test keeps the smallest signed distance of its
+    // positive vertex from any plane, so the box is disjoint when that is
+    // negative, and the player test keeps the smallest overlap over the three
+    // axes, so the boxes are apart when that is negative.  Either way the
+    // magnitude is how far the box can move before the result flips.  A
+    // visible box stays visible while any passing test still passes, a
+    // culled one stays culled while both fail.
+
+    uint8_t CullOctantScalar(const Frustumf& f, const AABoxf& playerBounds,
+        const OctantBoxes& boxes, float margins[8])
+    {
+        uint8_t mask = 0;
+        for (int idx = 0; idx < 8; ++idx)
+        {
+            float minPd = std::numeric_limits<float>::max();
+            for (int i = 0; i < 6; ++i)
+            {
+                const Planef& plane = f.mPlanes[i];
+                Vec3f positive(
+                    plane.mNorm[0] >= 0 ? boxes.maxx[idx] : boxes.minx[idx],
+                    plane.mNorm[1] >= 0 ? boxes.maxy[idx] : boxes.miny[idx],
+                    plane.mNorm[2] >= 0 ? boxes.maxz[idx] : boxes.minz[idx]);
+                minPd = std::min(minPd, dot(plane.mNorm, positive) + plane.mOffset);
+            }
+            float minOverlap = std::min(std::min(
+                std::min(playerBounds.mMax[0], boxes.maxx[idx]) - std::max(playerBounds.mMin[0], boxes.minx[idx]),
+                std::min(playerBounds.mMax[1], boxes.maxy[idx]) - std::max(playerBounds.mMin[1], boxes.miny[idx])),
+                std::min(playerBounds.mMax[2], boxes.maxz[idx]) - std::max(playerBounds.mMin[2], boxes.minz[idx]));
+
+            bool inFrustum = minPd >= 0;
+            bool intersectsPlayer = minOverlap >= 0;
+            float frustumMargin = fabsf(minPd);
+            float playerMargin = fabsf(minOverlap);
+            if (inFrustum || intersectsPlayer)
+            {
+                mask |= 1 << idx;
+                margins[idx] = std::max(inFrustum ? frustumMargin : 0, intersectsPlayer ? playerMargin : 0);
+            }
+            else
+                margins[idx] = std::min(frustumMargin, playerMargin);
+        }
+        return mask;
+    }
+
+#if defined(SAM_CULL_SSE)
+
+    uint8_t CullOctant(const Frustumf& f, const AABoxf& playerBounds,
+        const OctantBoxes& boxes, float margins[8])
+    {
+        const __m128 zero = _mm_setzero_ps();
+        const __m128 signBit = _mm_set1_ps(-0.0f);
+        int mask = 0;
+        for (int lane = 0; lane < 8; lane += 4)
+        {
+            __m128 minx = _mm_load_ps(boxes.minx + lane);
+            __m128 miny = _mm_load_ps(boxes.miny + lane);
+            __m128 minz = _mm_load_ps(boxes.minz + lane);
+            __m128 maxx = _mm_load_ps(boxes.maxx + lane);
+            __m128 maxy = _mm_load_ps(boxes.maxy + lane);
+            __m128 maxz = _mm_load_ps(boxes.maxz + lane);
+
+            __m128 minPd = _mm_set1_ps(std::numeric_limits<float>::max());
+            for (int i = 0; i < 6; ++i)
+            {
+                // The positive vertex is picked by the plane, the same for all lanes.
+                const Planef& plane = f.mPlanes[i];
+                __m128 px = plane.mNorm[0] >= 0 ? maxx : minx;
+                __m128 py = plane.mNorm[1] >= 0 ? maxy : miny;
+                __m128 pz = plane.mNorm[2] >= 0 ? maxz : minz;
+                __m128 pd = _mm_mul_ps(px, _mm_set1_ps(plane.mNorm[0]));
+                pd = _mm_add_ps(pd, _mm_mul_ps(py, _mm_set1_ps(plane.mNorm[1])));
+                pd = _mm_add_ps(pd, _mm_mul_ps(pz, _mm_set1_ps(plane.mNorm[2])));
+                pd = _mm_add_ps(pd, _mm_set1_ps(plane.mOffset));
+                minPd = _mm_min_ps(minPd, pd);
+            }
+
+            __m128 ox = _mm_sub_ps(_mm_min_ps(maxx, _mm_set1_ps(playerBounds.mMax[0])),
+                _mm_max_ps(minx, _mm_set1_ps(playerBounds.mMin[0])));
+            __m128 oy = _mm_sub_ps(_mm_min_ps(maxy, _mm_set1_ps(playerBounds.mMax[1])),
+                _mm_max_ps(miny, _mm_set1_ps(playerBounds.mMin[1])));
+            __m128 oz = _mm_sub_ps(_mm_min_ps(maxz, _mm_set1_ps(playerBounds.mMax[2])),
+                _mm_max_ps(minz, _mm_set1_ps(playerBounds.mMin[2])));
+            __m128 minOverlap = _mm_min_ps(_mm_min_ps(ox, oy), oz);
+
+            __m128 inFrustum = _mm_cmpge_ps(minPd, zero);
+            __m128 intersectsPlayer = _mm_cmpge_ps(minOverlap, zero);
+            __m128 visible = _mm_or_ps(inFrustum, intersectsPlayer);
+            __m128 frustumMargin = _mm_andnot_ps(signBit, minPd);
+            __m128 playerMargin = _mm_andnot_ps(signBit, minOverlap);
+            __m128 visibleMargin = _mm_max_ps(_mm_and_ps(inFrustum, frustumMargin),
+                _mm_and_ps(intersectsPlayer, playerMargin));
+            __m128 culledMargin = _mm_min_ps(frustumMargin, playerMargin);
+            _mm_storeu_ps(margins + lane, _mm_or_ps(_mm_and_ps(visible, visibleMargin),
+                _mm_andnot_ps(visible, culledMargin)));
+            mask |= _mm_movemask_ps(visible) << lane;
+        }
+        return (uint8_t)mask;
+    }
+
+#elif defined(SAM_CULL_NEON)
+
+    uint8_t CullOctant(const Frustumf& f, const AABoxf& playerBounds,
+        const OctantBoxes& boxes, float margins[8])
+    {
+        const float32x4_t zero = vdupq_n_f32(0);
+        const uint32_t laneBits[4] = { 1, 2, 4, 8 };
+        const uint32x4_t bits = vld1q_u32(laneBits);
+        int mask = 0;
+        for (int lane = 0; lane < 8; lane += 4)
+        {
+            float32x4_t minx = vld1q_f32(boxes.minx + lane);
+            float32x4_t miny = vld1q_f32(boxes.miny + lane);
+            float32x4_t minz = vld1q_f32(boxes.minz + lane);
+            float32x4_t maxx = vld1q_f32(boxes.maxx + lane);
+            float32x4_t maxy = vld1q_f32(boxes.maxy + lane);
+            float32x4_t maxz = vld1q_f32(boxes.maxz + lane);
+
+            float32x4_t minPd = vdupq_n_f32(std::numeric_limits<float>::max());
+            for (int i = 0; i < 6; ++i)
+            {
+                // The positive vertex is picked by the plane, the same for all lanes.
+                const Planef& plane = f.mPlanes[i];
+                float32x4_t px = plane.mNorm[0] >= 0 ? maxx : minx;
+                float32x4_t py = plane.mNorm[1] >= 0 ? maxy : miny;
+                float32x4_t pz = plane.mNorm[2] >= 0 ? maxz : minz;
+                // Separate multiply and add, so results match the scalar version.
+                float32x4_t pd = vmulq_n_f32(px, plane.mNorm[0]);
+                pd = vaddq_f32(pd, vmulq_n_f32(py, plane.mNorm[1]));
+                pd = vaddq_f32(pd, vmulq_n_f32(pz, plane.mNorm[2]));
+                pd = vaddq_f32(pd, vdupq_n_f32(plane.mOffset));
+                minPd = vminq_f32(minPd, pd);
+            }
+
+            float32x4_t ox = vsubq_f32(vminq_f32(maxx, vdupq_n_f32(playerBounds.mMax[0])),
+                vmaxq_f32(minx, vdupq_n_f32(playerBounds.mMin[0])));
+            float32x4_t oy = vsubq_f32(vminq_f32(maxy, vdupq_n_f32(playerBounds.mMax[1])),
+                vmaxq_f32(miny, vdupq_n_f32(playerBounds.mMin[1])));
+            float32x4_t oz = vsubq_f32(vminq_f32(maxz, vdupq_n_f32(playerBounds.mMax[2])),
+                vmaxq_f32(minz, vdupq_n_f32(playerBounds.mMin[2])));
+            float32x4_t minOverlap = vminq_f32(vminq_f32(ox, oy), oz);
+
+            uint32x4_t inFrustum = vcgeq_f32(minPd, zero);
+            uint32x4_t intersectsPlayer = vcgeq_f32(minOverlap, zero);
+            uint32x4_t visible = vorrq_u32(inFrustum, intersectsPlayer);
+            float32x4_t frustumMargin = vabsq_f32(minPd);
+            float32x4_t playerMargin = vabsq_f32(minOverlap);
+            float32x4_t visibleMargin = vmaxq_f32(vbslq_f32(inFrustum, frustumMargin, zero),
+                vbslq_f32(intersectsPlayer, playerMargin, zero));
+            float32x4_t culledMargin = vminq_f32(frustumMargin, playerMargin);
+            vst1q_f32(margins + lane, vbslq_f32(visible, visibleMargin, culledMargin));
+
+            uint32_t laneMask[4];
+            vst1q_u32(laneMask, vandq_u32(visible, bits));
+            mask |= (laneMask[0] | laneMask[1] | laneMask[2] | laneMask[3]) << lane;
+        }
+        return (uint8_t)mask;
+    }
+
+#else
+
+    uint8_t CullOctant(const Frustumf& f, const AABoxf& playerBounds,
+        const OctantBoxes& boxes, float margins[8])
+    {
+        return CullOctantScalar(f, playerBounds, boxes, margins);
+    }
+
+#endif
+}
@@ -0,0 +1,40 @@
+#pragma once
+
+#include <cstdint>
+#include <limits>
+#include <gmtl/gmtl.h>
+#include <gmtl/Point.h>
+#include <gmtl/AABox.h>
+#include <gmtl/Vec.h>
+#include <gmtl/Matrix.h>
+#include <gmtl/Plane.h>
+#include <gmtl/Frustum.h>
+#include "Loc.h"
+
+namespace sam
+{
+    // The eight children of an octree node in SoA layout, lane idx is
+    // Loc::GetChild(idx).
+    struct OctantBoxes
+    {
+        alignas(16) float minx[8];
+        alignas(16) float miny[8];
+        alignas(16) float minz[8];
+        alignas(16) float maxx[8];
+        alignas(16) float maxy[8];
+        alignas(16) float maxz[8];
+
+        void SetChildren(const Loc& parent);
+    };
+
+    // Tests all eight boxes against the frustum planes and playerBounds.
+    // Returns a bit per box that is not disjoint from the frustum or that
+    // intersects playerBounds.  margins gets how far each box can move
+    // before its result can change.
+    uint8_t CullOctant(const gmtl::Frustumf& f, const gmtl::AABoxf& playerBounds,
+        const OctantBoxes& boxes, float margins[8]);
+
+    // Reference version of CullOctant, one box at a time.
+    uint8_t CullOctantScalar(const gmtl::Frustumf& f, const gmtl::AABoxf& playerBounds,
+        const OctantBoxes& boxes, float margins[8]);
+}
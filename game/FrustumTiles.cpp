@@ -0,0 +1,288 @@
+#include "FrustumTiles.h"
+#include "CullKernel.h"
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+using namespace gmtl;
+
+namespace sam
+{
+    bool LodPolicy::KeepLevel(int l, float dist, bool isDrawn, float& margin) const
+    {
+        float boundary = powf(10.0f, (float)(8 - l));
+        // Leaving the current choice takes going band past the boundary.
+        float threshold = isDrawn ? boundary / (1 + band) : boundary * (1 + band);
+        // Reaching dist 0 (inside the tile) changes the rule too.
+        margin = std::min(fabsf(dist - threshold), dist);
+        return dist > threshold;
+    }
+
+    FrustumTiles::FrustumTiles()
+    {
+        m_frame.move = 0;
+        m_frame.turn = 0;
+        m_frame.maxlod = -1;
+    }
+
+    FrustumTiles::~FrustumTiles()
+    {
+    }
+
+    void FrustumTiles::Update(const TileView& view, int maxlod, const LodPolicy& policy, const AABoxf& playerBounds,
+        std::vector<Loc>& added, std::vector<Loc>& removed)
+    {
+        const Vec3f* dirs = view.dirs;
+        const Matrix44f& proj = view.proj;
+        Point3f playerCenter = (playerBounds.mMin + playerBounds.mMax) * 0.5f;
+        Vec3f playerExtent = playerBounds.mMax - playerBounds.mMin;
+
+        m_frame.added = &added;
+        m_frame.removed = &removed;
+        // Anything that isn't a rigid camera move starts over.
+        bool rebuild = m_root == nullptr || maxlod != m_frame.maxlod ||
+            policy.band != m_frame.policy.band || proj != m_lastProj;
+        if (!rebuild)
+        {
+            // Resizing the player bounds moves their faces by up to half
+            // the change.
+            float playerMove = length(Vec3f(playerCenter - m_lastPlayerCenter)) +
+                length(Vec3f(playerExtent - m_lastPlayerExtent)) * 0.5f;
+            float move = std::max(length(Vec3f(view.pos - m_lastCamPos)), playerMove);
+            // Rotation angle between the two camera bases, from the trace.
+            float trace = dot(dirs[0], m_lastDirs[0]) + dot(dirs[1], m_lastDirs[1]) + dot(dirs[2], m_lastDirs[2]);
+            float turn = acosf(std::clamp((trace - 1) * 0.5f, -1.0f, 1.0f));
+            m_frame.move += move;
+            m_frame.turn += turn;
+        }
+        m_frame.frustum = view.frustum;
+        m_frame.camPos = view.pos;
+        m_frame.playerBounds = playerBounds;
+        m_frame.maxlod = maxlod;
+        m_frame.policy = policy;
+        m_lastCamPos = view.pos;
+        for (int i = 0; i < 3; ++i)
+            m_lastDirs[i] = dirs[i];
+        m_lastPlayerCenter = playerCenter;
+        m_lastPlayerExtent = playerExtent;
+        m_lastProj = proj;
+
+        if (rebuild)
+        {
+            if (m_root != nullptr)
+                RemoveSubtree(*m_root);
+            m_root = std::make_unique<Node>(Loc(0, 0, 0, 0));
+            Evaluate(*m_root);
+            UpdateSubtree(*m_root);
+        }
+        else
+            Visit(*m_root);
+    }
+
+    bool FrustumTiles::IsStale(double move, double turn, float margin, float radius, const Frame& f)
+    {
+        double dm = f.move - move;
+        return dm + (f.turn - turn) * (radius + dm) >= margin;
+    }
+
+    void FrustumTiles::Visit(Node& n)
+    {
+        if (!IsStale(n.subMove, n.subTurn, n.subMargin, n.subRadius, m_frame))
+            return;
+        if (IsStale(n.evalMove, n.evalTurn, n.margin, n.radius, m_frame))
+            Evaluate(n);
+        else
+        {
+            for (auto& child : n.children)
+            {
+                if (child != nullptr)
+                    Visit(*child);
+            }
+            UpdateFill(n);
+        }
+        UpdateSubtree(n);
+    }
+
+    void FrustumTiles::Evaluate(Node& n)
+    {
+        const Loc& l = n.loc;
+        AABoxf bbox = l.GetBBox();
+        const Point3f& camPos = m_frame.camPos;
+        float dist = DistanceToAAbb(camPos, bbox);
+        float lodMargin;
+        bool selected;
+        if (dist == 0)
+        {
+            // Inside the tile only the finest level is drawn.
+            selected = l.m_l == m_frame.maxlod;
+            lodMargin = std::numeric_limits<float>::max();
+            for (int i = 0; i < 3; ++i)
+                lodMargin = std::min(lodMargin, std::min(camPos[i] - bbox.mMin[i], bbox.mMax[i] - camPos[i]));
+        }
+        else
+            selected = m_frame.policy.KeepLevel(l.m_l, dist, n.selected, lodMargin);
+        n.margin = lodMargin;
+        n.radius = FarDistanceToAAbb(m_frame.camPos, bbox);
+        n.evalMove = m_frame.move;
+        n.evalTurn = m_frame.turn;
+
+        if (selected)
+        {
+            if (!n.selected)
+            {
+                RemoveChildren(n);
+                n.selected = true;
+                Add(l);
+            }
+            return;
+        }
+
+        if (n.selected)
+        {
+            n.selected = false;
+            Remove(l);
+        }
+        if (l.m_l < m_frame.maxlod)
+        {
+            OctantBoxes boxes;
+            boxes.SetChildren(l);
+            float cullMargins[8];
+            uint8_t visible = CullOctant(m_frame.frustum, m_frame.playerBounds, boxes, cullMargins);
+            for (int idx = 0; idx < 8; ++idx)
+            {
+                n.margin = std::min(n.margin, cullMargins[idx]);
+                std::unique_ptr<Node>& child = n.children[idx];
+                if (visible & (1 << idx))
+                {
+                    if (child == nullptr)
+                    {
+                        child = std::make_unique<Node>(l.GetChild(idx));
+                        Evaluate(*child);
+                        UpdateSubtree(*child);
+                    }
+                    else
+                        Visit(*child);
+                }
+                else if (child != nullptr)
+                {
+                    DropChild(n, idx);
+                }
+            }
+        }
+        UpdateFill(n);
+    }
+
+    void FrustumTiles::UpdateFill(Node& n)
+    {
+        bool hasChildren = false;
+        uint8_t existMask = 0, presentMask = 0;
+        for (int idx = 0; idx < 8; ++idx)
+        {
+            if (n.children[idx] == nullptr)
+                continue;
+            presentMask |= 1 << idx;
+            if (n.children[idx]->Exists())
+            {
+                existMask |= 1 << idx;
+                hasChildren = true;
+            }
+        }
+        uint8_t fillMask = hasChildren ? (presentMask & ~existMask) : 0;
+        uint8_t changed = fillMask ^ n.fillMask;
+        for (int idx = 0; idx < 8 && changed != 0; ++idx)
+        {
+            if (!(changed & (1 << idx)))
+                continue;
+            if (fillMask & (1 << idx))
+                Add(n.children[idx]->loc);
+            else
+                Remove(n.loc.GetChild(idx));
+        }
+        n.fillMask = fillMask;
+        n.hasChildren = hasChildren;
+    }
+
+    void FrustumTiles::UpdateSubtree(Node& n)
+    {
+        n.subMove = n.evalMove;
+        n.subTurn = n.evalTurn;
+        n.subMargin = n.margin;
+        n.subRadius = n.radius;
+        for (auto& child : n.children)
+        {
+            if (child == nullptr)
+                continue;
+            n.subMove = std::min(n.subMove, child->subMove);
+            n.subTurn = std::min(n.subTurn, child->subTurn);
+            n.subMargin = std::min(n.subMargin, child->subMargin);
+            n.subRadius = std::max(n.subRadius, child->subRadius);
+        }
+    }
+
+    void FrustumTiles::DropChild(Node& n, int idx)
+    {
+        if (n.fillMask & (1 << idx))
+        {
+            Remove(n.children[idx]->loc);
+            n.fillMask &= ~(1 << idx);
+        }
+        RemoveSubtree(*n.children[idx]);
+        n.children[idx].reset();
+    }
+
+    void FrustumTiles::RemoveChildren(Node& n)
+    {
+        for (int idx = 0; idx < 8; ++idx)
+        {
+            if (n.children[idx] != nullptr)
+                DropChild(n, idx);
+        }
+        n.hasChildren = false;
+    }
+
+    void FrustumTiles::RemoveSubtree(Node& n)
+    {
+        if (n.selected)
+            Remove(n.loc);
+        for (int idx = 0; idx < 8; ++idx)
+        {
+            if (n.children[idx] == nullptr)
+                continue;
+            if (n.fillMask & (1 << idx))
+                Remove(n.children[idx]->loc);
+            RemoveSubtree(*n.children[idx]);
+        }
+    }
+
+    void FrustumTiles::Add(const Loc& l)
+    {
+        m_frame.added->push_back(l);
+    }
+
+    void FrustumTiles::Remove(const Loc& l)
+    {
+        m_frame.removed->push_back(l);
+    }
+
+    static inline float clampf(float v, float vmin, float vmax)
+    {
+        return std::max(vmin, std::min(vmax, v));
+    }
+
+    float FrustumTiles::DistanceToAAbb(const Point3f& v, const AABoxf& bbox)
+    {
+        Point3f closestpt(clampf(v[0], bbox.mMin[0], bbox.mMax[0]),
+            clampf(v[1], bbox.mMin[1], bbox.mMax[1]),
+            clampf(v[2], bbox.mMin[2], bbox.mMax[2]));
+        Vec3f closestVec = v - closestpt;
+        return length(closestVec);
+    }
+
+    float FrustumTiles::FarDistanceToAAbb(const Point3f& v, const AABoxf& bbox)
+    {
+        Vec3f farVec;
+        for (int i = 0; i < 3; ++i)
+            farVec[i] = std::max(fabsf(v[i] - bbox.mMin[i]), fabsf(v[i] - bbox.mMax[i]));
+        return length(farVec);
+    }
+}
\ No newline at end of file
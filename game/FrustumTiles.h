@@ -0,0 +1,143 @@
+#pragma once
+
+#include <memory>
+#include <vector>
+#include <limits>
+#include <gmtl/gmtl.h>
+#include <gmtl/Point.h>
+#include <gmtl/AABox.h>
+#include <gmtl/Vec.h>
+#include <gmtl/Matrix.h>
+#include <gmtl/Plane.h>
+#include <gmtl/Frustum.h>
+#include "Loc.h"
+
+namespace sam
+{
+    // Picks tile levels by camera distance.  A level l tile is drawn rather
+    // than refined beyond 10^(8-l) units, and keeps its current choice until
+    // the camera is band (a fraction of that distance) past the boundary, so
+    // moving back and forth across it doesn't swap tiles every frame.
+    struct LodPolicy
+    {
+        float band = 0.15f;
+        // Tiles that drop out of view are kept this long, and up to this
+        // many, so they come back without another fetch.
+        float graceSeconds = 5.0f;
+        size_t graceMaxTiles = 1024;
+
+        // margin is how far the camera can move before the result can change.
+        bool KeepLevel(int l, float dist, bool isDrawn, float& margin) const;
+    };
+
+    // The camera tiles are selected for.  dirs are right, up and forward.
+    // Kept free of Camera so the selection runs without a renderer.
+    struct TileView
+    {
+        gmtl::Point3f pos;
+        gmtl::Vec3f dirs[3];
+        gmtl::Matrix44f proj;
+        gmtl::Frustumf frustum;
+    };
+
+    // Persistent octree selection.  Each node remembers its last LOD and
+    // culling decisions along with how far the camera can move or turn before
+    // they could change, so a frame only re-evaluates nodes whose budget ran
+    // out and reports the tiles that were added or removed.
+    class FrustumTiles
+    {
+    public:
+        // Depth range of the culling frustum.
+        static constexpr float NearDist = 0.1f;
+        static constexpr float FarDist = 150.0f;
+
+        FrustumTiles();
+        ~FrustumTiles();
+
+        void Update(const TileView& view, int maxlod, const LodPolicy& policy, const gmtl::AABoxf& playerBounds,
+            std::vector<Loc>& added, std::vector<Loc>& removed);
+
+    private:
+        struct Node
+        {
+            Node(const Loc& l) :
+                loc(l),
+                evalMove(0),
+                evalTurn(0),
+                margin(-1),
+                radius(0),
+                subMove(0),
+                subTurn(0),
+                subMargin(-1),
+                subRadius(0),
+                selected(false),
+                hasChildren(false),
+                fillMask(0) {}
+
+            Loc loc;
+            // Camera motion totals when this node was last evaluated, the
+            // distance points can move relative to the camera before its
+            // decisions can change, and the furthest corner's distance from
+            // the camera (turning moves far points further).
+            double evalMove;
+            double evalTurn;
+            float margin;
+            float radius;
+            // The same, combined over the whole subtree.
+            double subMove;
+            double subTurn;
+            float subMargin;
+            float subRadius;
+            // This node is a selected tile.
+            bool selected;
+            // Some child subtree has selected tiles.
+            bool hasChildren;
+            // Children selected as fill because their own subtree is empty.
+            uint8_t fillMask;
+            // Children that passed culling.
+            std::unique_ptr<Node> children[8];
+
+            bool Exists() const
+            { return selected || hasChildren; }
+        };
+
+        struct Frame
+        {
+            gmtl::Frustumf frustum;
+            gmtl::Point3f camPos;
+            gmtl::AABoxf playerBounds;
+            int maxlod;
+            LodPolicy policy;
+            double move;
+            double turn;
+            std::vector<Loc>* added;
+            std::vector<Loc>* removed;
+        };
+
+        std::unique_ptr<Node> m_root;
+        Frame m_frame;
+        gmtl::Point3f m_lastCamPos;
+        gmtl::Vec3f m_lastDirs[3];
+        gmtl::Point3f m_lastPlayerCenter;
+        gmtl::Vec3f m_lastPlayerExtent;
+        gmtl::Matrix44f m_lastProj;
+
+        static bool IsStale(double move, double turn, float margin, float radius, const Frame& f);
+        void Visit(Node& n);
+        void Evaluate(Node& n);
+        // Children whose subtree has no tiles are selected themselves, but
+        // only when a sibling's subtree does.
+        void UpdateFill(Node& n);
+        void UpdateSubtree(Node& n);
+        void DropChild(Node& n, int idx);
+        void RemoveChildren(Node& n);
+        // Reports every tile the subtree selected as removed.
+        void RemoveSubtree(Node& n);
+        void Add(const Loc& l);
+        void Remove(const Loc& l);
+
+        static float DistanceToAAbb(const gmtl::Point3f& v, const gmtl::AABoxf& bbox);
+        // Distance from v to the furthest point of bbox.
+        static float FarDistanceToAAbb(const gmtl::Point3f& v, const gmtl::AABoxf& bbox);
+    };
+}
\ No newline at end of file
@@ -28,6 +28,10 @@ namespace sam
     extern std::string g_partName;
     extern Loc g_inLoc;
     extern float g_overlap;
+    extern float g_tilesCreatedPerSec;
+    extern float g_tilesRevivedPerSec;
+    extern float g_tilesDestroyedPerSec;
+    extern float g_prefetchUsedPct;
 
     bool g_showStats = true;
 extern int g_buttonDown;
@@ -51,6 +55,9 @@ extern int g_buttonDown;
             bgfx::dbgTextPrintf(0, 1, 0x0f, "Pos [%f %f %f]", la.pos[0], la.pos[1], la.pos[2]);
             bgfx::dbgTextPrintf(0, 2, 0x0f, "Dir [%f %f]", la.dir[0], la.dir[1]);
             bgfx::dbgTextPrintf(0, 3, 0x0f, "Fwd [%f %f %f]", f[0], f[1], f[2]);
+            bgfx::dbgTextPrintf(0, 4, 0x0f, "Tiles/s [created %.1f revived %.1f destroyed %.1f]",
+                g_tilesCreatedPerSec, g_tilesRevivedPerSec, g_tilesDestroyedPerSec);
+            bgfx::dbgTextPrintf(0, 5, 0x0f, "Prefetch used [%.1f%%]", g_prefetchUsedPct);
         }
         //bgfx::setTransform(m.getData());
         Quad::init();
@@ -15,9 +15,10 @@
 
 namespace sam
 {
-    LegoBrick::LegoBrick(const PartInst& pi, int atlasidx, bool hires, Physics physics, bool showConnectors
+    LegoBrick::LegoBrick(const PartInst& pi, int atlasidx, BrickDetail detail, Physics physics, bool showConnectors
         ) :
         m_partinst(pi),
+        m_tileLoc(0, 0, 0, 0),
         m_paletteIdx(atlasidx),
         m_showConnectors(showConnectors),
         m_connectorPickIdx(-1),
@@ -25,7 +26,7 @@ namespace sam
         m_rigidBody(nullptr),
         m_initialState(nullptr),
         m_physicsType(physics),
-        m_hires(hires),
+        m_detail(detail),
         m_dbgCollided(false)
     {
 
@@ -37,6 +38,7 @@ namespace sam
     static bgfx::ProgramHandle sShaderBbox(BGFX_INVALID_HANDLE);
     static bgfx::UniformHandle sPaletteHandle(BGFX_INVALID_HANDLE);
     static bgfxh<bgfx::UniformHandle> sUparams;
+    static bgfxh<bgfx::UniformHandle> sMeshBounds;
 
     void LegoBrick::Initialize(DrawContext& dc)
     {
@@ -44,10 +46,11 @@ namespace sam
         {
             sShader = Engine::Inst().LoadShader("vs_brick.bin", "fs_cubes.bin");
             sShader2 = Engine::Inst().LoadShader("vs_connector.bin", "fs_pickconnector.bin");
-            sShader3 = Engine::Inst().LoadShader("vs_connector.bin", "fs_pickbrick.bin");
+            sShader3 = Engine::Inst().LoadShader("vs_brickpick.bin", "fs_pickbrick.bin");
             sPaletteHandle = bgfx::createUniform("s_brickPalette", bgfx::UniformType::Sampler);
+            sMeshBounds = bgfx::createUniform("u_meshBounds", bgfx::UniformType::Vec4, 2);
         }
-        m_pBrick = BrickManager::Inst().GetBrick(m_partinst.id, m_hires);
+        m_pBrick = BrickManager::Inst().GetBrick(m_partinst.id, m_detail);
         if (!sUparams.isValid())
             sUparams = bgfx::createUniform("u_params", bgfx::UniformType::Vec4, 1);
 
@@ -118,11 +121,12 @@ namespace sam
     void LegoBrick::Draw(DrawContext& ctx)
     {
         SceneGroup::Draw(ctx);
-        if (!bgfx::isValid(m_pBrick->m_vbhHR))
+        if (m_pBrick == nullptr)
             return;
-        if (m_pBrick != nullptr)
-            BrickManager::Inst().MruUpdate(m_pBrick.get());
-        PosTexcoordNrmVertex::init();
+        const BrickMesh* mesh = m_pBrick->DrawMesh(m_detail);
+        if (mesh == nullptr)
+            return;
+        BrickManager::Inst().MruUpdate(m_pBrick.get());
         Matrix44f m = ctx.m_mat *
             CalcMat();
             
@@ -143,10 +147,11 @@ namespace sam
             bgfx::setTexture(0, sPaletteHandle, BrickManager::Inst().Palette());
             Vec4f color = Vec4f(m_paletteIdx, 0, 0, 0);
             bgfx::setUniform(sUparams, &color, 1);
+            bgfx::setUniform(sMeshBounds, mesh->m_packRange, 2);
 
             bgfx::setState(state);
-            bgfx::setVertexBuffer(0, m_pBrick->m_vbhHR);
-            bgfx::setIndexBuffer(m_pBrick->m_ibhHR);
+            bgfx::setVertexBuffer(0, mesh->m_vbh);
+            bgfx::setIndexBuffer(mesh->m_ibh);
             bgfx::submit(DrawViewId::MainObjects, sShader);
         }
         else
@@ -202,10 +207,11 @@ namespace sam
             bgfx::setTransform(m.getData());
             bgfx::setTexture(0, sPaletteHandle, BrickManager::Inst().Palette());
             bgfx::setUniform(sUparams, &p, 1);
+            bgfx::setUniform(sMeshBounds, mesh->m_packRange, 2);
 
             bgfx::setState(state);
-            bgfx::setVertexBuffer(0, m_pBrick->m_vbhHR);
-            bgfx::setIndexBuffer(m_pBrick->m_ibhHR);
+            bgfx::setVertexBuffer(0, mesh->m_vbh);
+            bgfx::setIndexBuffer(mesh->m_ibh);
             bgfx::submit(DrawViewId::PickObjects, sShader3);
         }
     }
@@ -4,6 +4,7 @@
 #include <set>
 #include "SceneItem.h"
 #include "PartDefs.h"
+#include "Loc.h"
 
 class btDefaultMotionState;
 class btRigidBody;
@@ -12,6 +13,7 @@ namespace sam
 {
     class BrickManager;
     class Brick;   
+    enum BrickDetail : int;
     class LegoBrick : public SceneGroup
     {        
     public:
@@ -21,7 +23,7 @@ namespace sam
             Static,
             Dynamic
         };
-        LegoBrick(const PartInst& pi, int atlasidx, bool hires, Physics physics = Physics::None, bool showConnectors = false);
+        LegoBrick(const PartInst& pi, int atlasidx, BrickDetail detail, Physics physics = Physics::None, bool showConnectors = false);
         virtual ~LegoBrick();
         void Decomission(DrawContext& ctx) override;
         void Initialize(DrawContext& nvg) override;
@@ -33,16 +35,28 @@ namespace sam
         { return m_connectorPickIdx; }
         const PartInst &GetPartInst() const
         { return m_partinst; }
+        // The tile this brick was built from, and its part there.
+        void SetTilePart(const Loc& tileLoc, const PartHandle& handle)
+        {
+            m_tileLoc = tileLoc;
+            m_tilePart = handle;
+        }
+        const Loc& GetTileLoc() const
+        { return m_tileLoc; }
+        const PartHandle& GetTilePart() const
+        { return m_tilePart; }
         void SetDbgCollided(bool c) {
             m_dbgCollided = c;
         }
     private:
         Matrix44f CalcMat() const override;
         PartInst m_partinst;
+        Loc m_tileLoc;
+        PartHandle m_tilePart;
         std::shared_ptr<Brick> m_pBrick;
         int m_paletteIdx;
         bool m_showConnectors;
-        bool m_hires;
+        BrickDetail m_detail;
         int m_connectorPickIdx;
         bool m_dbgCollided;
         Physics m_physicsType;
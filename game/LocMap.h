@@ -0,0 +1,155 @@
+#pragma once
+
+#include <vector>
+#include "Loc.h"
+
+namespace sam
+{
+    // Open addressing hash map keyed by Loc::GetPackedCode, with linear
+    // probing and backward shift deletion.  Iterators are invalidated by
+    // insert and erase.
+    template <typename T> class LocMap
+    {
+        static constexpr uint64_t Empty = ~0ull;
+
+        std::vector<uint64_t> m_codes;
+        std::vector<std::pair<Loc, T>> m_slots;
+        size_t m_size;
+        size_t m_mask;
+
+        size_t Home(uint64_t code) const
+        {
+            code *= 0x9E3779B97F4A7C15ull;
+            return (size_t)(code ^ (code >> 32)) & m_mask;
+        }
+
+        size_t FindSlot(uint64_t code) const
+        {
+            for (size_t idx = Home(code);; idx = (idx + 1) & m_mask)
+            {
+                if (m_codes[idx] == code || m_codes[idx] == Empty)
+                    return idx;
+            }
+        }
+
+        void Grow()
+        {
+            std::vector<uint64_t> codes(m_codes.size() * 2, Empty);
+            std::vector<std::pair<Loc, T>> slots(m_slots.size() * 2);
+            std::swap(codes, m_codes);
+            std::swap(slots, m_slots);
+            m_mask = m_codes.size() - 1;
+            for (size_t idx = 0; idx < codes.size(); ++idx)
+            {
+                if (codes[idx] == Empty)
+                    continue;
+                size_t newIdx = FindSlot(codes[idx]);
+                m_codes[newIdx] = codes[idx];
+                m_slots[newIdx] = std::move(slots[idx]);
+            }
+        }
+
+    public:
+        class iterator
+        {
+            LocMap* m_map;
+            size_t m_idx;
+            friend class LocMap;
+
+            void SkipEmpty()
+            {
+                while (m_idx < m_map->m_codes.size() && m_map->m_codes[m_idx] == Empty)
+                    m_idx++;
+            }
+        public:
+            iterator(LocMap* map, size_t idx) :
+                m_map(map),
+                m_idx(idx) {}
+
+            std::pair<Loc, T>& operator*() const { return m_map->m_slots[m_idx]; }
+            std::pair<Loc, T>* operator->() const { return &m_map->m_slots[m_idx]; }
+            iterator& operator++()
+            {
+                m_idx++;
+                SkipEmpty();
+                return *this;
+            }
+            bool operator == (const iterator& rhs) const { return m_idx == rhs.m_idx; }
+            bool operator != (const iterator& rhs) const { return m_idx != rhs.m_idx; }
+        };
+
+        LocMap() :
+            m_codes(16, Empty),
+            m_slots(16),
+            m_size(0),
+            m_mask(15) {}
+
+        iterator begin()
+        {
+            iterator it(this, 0);
+            it.SkipEmpty();
+            return it;
+        }
+
+        iterator end()
+        {
+            return iterator(this, m_codes.size());
+        }
+
+        size_t size() const { return m_size; }
+
+        iterator find(const Loc& l)
+        {
+            // Outside the octree, and the packed code would alias another tile.
+            unsigned int dim = 1u << l.m_l;
+            if ((unsigned int)l.m_x >= dim || (unsigned int)l.m_y >= dim || (unsigned int)l.m_z >= dim)
+                return end();
+            size_t idx = FindSlot(l.GetPackedCode());
+            return m_codes[idx] == Empty ? end() : iterator(this, idx);
+        }
+
+        std::pair<iterator, bool> insert(const std::pair<Loc, T>& kv)
+        {
+            // Keep the load factor under 3/4.
+            if ((m_size + 1) * 4 > m_codes.size() * 3)
+                Grow();
+            uint64_t code = kv.first.GetPackedCode();
+            size_t idx = FindSlot(code);
+            if (m_codes[idx] != Empty)
+                return std::make_pair(iterator(this, idx), false);
+            m_codes[idx] = code;
+            m_slots[idx] = kv;
+            m_size++;
+            return std::make_pair(iterator(this, idx), true);
+        }
+
+        void erase(iterator it)
+        {
+            size_t hole = it.m_idx;
+            m_slots[hole] = std::pair<Loc, T>();
+            m_codes[hole] = Empty;
+            m_size--;
+            // Move back any later entry of the probe run that can fill the hole.
+            for (size_t idx = (hole + 1) & m_mask; m_codes[idx] != Empty; idx = (idx + 1) & m_mask)
+            {
+                size_t home = Home(m_codes[idx]);
+                if (((idx - home) & m_mask) < ((idx - hole) & m_mask))
+                    continue;
+                m_codes[hole] = m_codes[idx];
+                m_slots[hole] = std::move(m_slots[idx]);
+                m_codes[idx] = Empty;
+                m_slots[idx] = std::pair<Loc, T>();
+                hole = idx;
+            }
+        }
+
+        size_t erase(const Loc& l)
+        {
+            iterator it = find(l);
+            if (it == end())
+                return 0;
+            erase(it);
+            return 1;
+        }
+    };
+}
\ No newline at end of file
@@ -3,6 +3,7 @@
 
 bgfx::VertexLayout PosTexcoordVertex::ms_layout;
 bgfx::VertexLayout PosTexcoordNrmVertex::ms_layout;
+bgfx::VertexLayout BrickVertexLayout::ms_layout;
 bgfx::VertexLayout VoxelVertex::ms_layout;
 
 bool Cube::isInit = false;
@@ -54,6 +54,26 @@ struct PosTexcoordNrmVertex
     static bgfx::VertexLayout ms_layout;
 };
 
+// GPU layout of sam::BrickVertex, decoded by shaders/brick.sh.
+struct BrickVertexLayout
+{
+    static void init()
+    {
+        static bool isinit = false;
+        if (!isinit)
+        {
+            ms_layout
+                .begin()
+                .add(bgfx::Attrib::Position, 4, bgfx::AttribType::Int16, true)
+                .add(bgfx::Attrib::Color0, 4, bgfx::AttribType::Uint8, true)
+                .end();
+            isinit = true;
+        }
+    };
+
+    static bgfx::VertexLayout ms_layout;
+};
+
 struct VoxelVertex
 {
     float x;
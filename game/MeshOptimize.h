@@ -0,0 +1,180 @@
+#pragma once
+
+#include <cstdint>
+#include <cmath>
+#include <vector>
+#include <algorithm>
+
+// Index and vertex ordering for brick meshes, shared by the partmake
+// exporter and the game's Lod generation so it has no engine dependencies.
+namespace sam
+{
+    // Forsyth's linear speed vertex cache optimisation: greedily emits the
+    // triangle whose vertices score best against a simulated LRU cache, which
+    // favors vertices already in the cache and those with few triangles left.
+    namespace forsyth
+    {
+        const int CacheSize = 32;
+        const float CacheDecayPower = 1.5f;
+        const float LastTriScore = 0.75f;
+        const float ValenceBoostScale = 2.0f;
+        const float ValenceBoostPower = 0.5f;
+
+        inline float VertexScore(int cachePos, uint32_t remainingTris)
+        {
+            if (remainingTris == 0)
+                return -1.0f;
+            float score = 0;
+            if (cachePos >= 0)
+            {
+                // The last triangle's vertices get a fixed score so the next
+                // triangle doesn't just reuse its edge.
+                if (cachePos < 3)
+                    score = LastTriScore;
+                else
+                {
+                    float scaler = 1.0f / (CacheSize - 3);
+                    score = std::pow(1.0f - (cachePos - 3) * scaler, CacheDecayPower);
+                }
+            }
+            score += ValenceBoostScale * std::pow((float)remainingTris, -ValenceBoostPower);
+            return score;
+        }
+    }
+
+    inline void OptimizeVertexCache(std::vector<uint32_t>& indices, uint32_t numvtx)
+    {
+        using namespace forsyth;
+        uint32_t numtris = (uint32_t)(indices.size() / 3);
+        if (numtris == 0)
+            return;
+
+        // Triangles using each vertex, as offsets into vtxTris.
+        std::vector<uint32_t> triStart(numvtx + 1, 0);
+        for (uint32_t i : indices)
+            triStart[i + 1]++;
+        for (uint32_t v = 0; v < numvtx; ++v)
+            triStart[v + 1] += triStart[v];
+        std::vector<uint32_t> vtxTris(indices.size());
+        std::vector<uint32_t> remaining(numvtx, 0);
+        for (uint32_t t = 0; t < numtris; ++t)
+        {
+            for (int k = 0; k < 3; ++k)
+            {
+                uint32_t v = indices[t * 3 + k];
+                vtxTris[triStart[v] + remaining[v]++] = t;
+            }
+        }
+
+        std::vector<int> cachePos(numvtx, -1);
+        std::vector<float> vtxScore(numvtx);
+        for (uint32_t v = 0; v < numvtx; ++v)
+            vtxScore[v] = VertexScore(-1, remaining[v]);
+        std::vector<float> triScore(numtris);
+        std::vector<bool> triAdded(numtris, false);
+        for (uint32_t t = 0; t < numtris; ++t)
+            triScore[t] = vtxScore[indices[t * 3]] + vtxScore[indices[t * 3 + 1]] +
+                vtxScore[indices[t * 3 + 2]];
+
+        std::vector<uint32_t> cache;
+        std::vector<uint32_t> newCache;
+        cache.reserve(CacheSize + 3);
+        newCache.reserve(CacheSize + 3);
+        std::vector<uint32_t> out;
+        out.reserve(indices.size());
+        // Lowest triangle that may not be added yet, for when nothing in the
+        // cache has triangles left.
+        uint32_t scanPos = 0;
+        int64_t best = -1;
+        for (uint32_t emitted = 0; emitted < numtris; ++emitted)
+        {
+            if (best < 0)
+            {
+                float bestScore = -1e30f;
+                for (uint32_t t = scanPos; t < numtris; ++t)
+                {
+                    if (!triAdded[t] && triScore[t] > bestScore)
+                    {
+                        bestScore = triScore[t];
+                        best = t;
+                    }
+                }
+            }
+            uint32_t tri = (uint32_t)best;
+            triAdded[tri] = true;
+            while (scanPos < numtris && triAdded[scanPos])
+                scanPos++;
+
+            // Move the triangle's vertices to the front of the cache and drop
+            // it from their remaining triangles.
+            newCache.clear();
+            for (int k = 0; k < 3; ++k)
+            {
+                uint32_t v = indices[tri * 3 + k];
+                out.push_back(v);
+                newCache.push_back(v);
+                uint32_t* begin = &vtxTris[triStart[v]];
+                uint32_t* end = begin + remaining[v];
+                *std::find(begin, end, tri) = *(end - 1);
+                remaining[v]--;
+            }
+            for (uint32_t v : cache)
+            {
+                if (v != newCache[0] && v != newCache[1] && v != newCache[2])
+                    newCache.push_back(v);
+            }
+            for (size_t p = 0; p < newCache.size(); ++p)
+                cachePos[newCache[p]] = p < (size_t)CacheSize ? (int)p : -1;
+            std::swap(cache, newCache);
+
+            // Rescore the touched vertices and their triangles, and pick the
+            // next triangle among them.
+            best = -1;
+            float bestScore = -1e30f;
+            for (uint32_t v : cache)
+            {
+                float score = VertexScore(cachePos[v], remaining[v]);
+                float delta = score - vtxScore[v];
+                vtxScore[v] = score;
+                for (uint32_t i = 0; i < remaining[v]; ++i)
+                    triScore[vtxTris[triStart[v] + i]] += delta;
+            }
+            for (uint32_t v : cache)
+            {
+                for (uint32_t i = 0; i < remaining[v]; ++i)
+                {
+                    uint32_t t = vtxTris[triStart[v] + i];
+                    if (triScore[t] > bestScore)
+                    {
+                        bestScore = triScore[t];
+                        best = t;
+                    }
+                }
+            }
+            if (cache.size() > (size_t)CacheSize)
+                cache.resize(CacheSize);
+        }
+        indices.swap(out);
+    }
+
+    // Renumbers vertices in the order the indices first use them, dropping any
+    // that are never referenced.
+    template <typename Vertex> void OptimizeVertexFetch(std::vector<Vertex>& vertices,
+        std::vector<uint32_t>& indices)
+    {
+        const uint32_t unused = (uint32_t)(-1);
+        std::vector<uint32_t> remap(vertices.size(), unused);
+        std::vector<Vertex> out;
+        out.reserve(vertices.size());
+        for (uint32_t& i : indices)
+        {
+            if (remap[i] == unused)
+            {
+                remap[i] = (uint32_t)out.size();
+                out.push_back(vertices[i]);
+            }
+            i = remap[i];
+        }
+        vertices.swap(out);
+    }
+}
\ No newline at end of file
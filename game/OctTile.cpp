@@ -8,6 +8,7 @@
 #include "gmtl/Intersection.h"
 #include "BrickMgr.h"
 #include "LegoBrick.h"
+#include "PartChunk.h"
 
 #define NOMINMAX
 
@@ -18,15 +19,25 @@ namespace sam
     bgfxh<bgfx::ProgramHandle> sBrickShader;
     static bgfx::UniformHandle sPaletteHandle(BGFX_INVALID_HANDLE);
 
-    OctTile::OctTile(const Loc& l) : m_image(-1), m_l(l),
+    // Bricks get coarser a level at a time away from the finest tiles, so
+    // the coarsest tiles that load parts (level 5) get DetailLod3.
+    static BrickDetail DetailForLevel(int l)
+    {
+        if (l >= 8)
+            return DetailHires;
+        return (BrickDetail)std::min((int)DetailLod3, (int)DetailLores + 8 - l);
+    }
+
+    OctTile::OctTile(const Loc& l) : TileLoad(l),
+        m_image(-1),
         m_buildFrame(0),
-        m_readyState(0),
         m_intersects(-1),
         m_lastUsedRawData(0),
         m_isdecommissioned(false),
         m_needsPersist(false),
         m_needsRefresh(false)
     {
+        m_partIndex.Reset(l.GetExtent());
     }
 
 
@@ -96,87 +107,117 @@ namespace sam
     }
 
     
-    bool OctTile::BackgroundLoad(World* pWorld)
+    void OctTile::OnFetched(const PacketBuffer& buf, LoadedParts& loaded)
     {
-        if (m_readyState == 0)
+        // Queue every decode before waiting so they run in parallel.
+        BrickDetail detail = DetailForLevel(m_l.m_l);
+        std::vector<BrickManager::BrickFuture> bricks;
+        bricks.reserve(loaded.parts.size());
+        for (auto& part : loaded.parts)
         {
-            m_readyState = 1;
-            if (m_l.m_l == 8)
-            {
-                bool success = false;
-                std::string strval;
-                if (pWorld->Level()->GetOctChunk(ILevel::OctKey(m_l, 0), &strval))
-                {
-                    size_t parts = strval.size() / sizeof(PartInst);
-                    m_parts.resize(parts);
-                    memcpy(m_parts.data(), strval.data(), strval.size());
-                    for (auto& part : m_parts)
-                    {
-                        m_bricks.push_back(BrickManager::Inst().GetBrick(part.id));
-                    }
-                    m_readyState = 3;
-                    m_needsRefresh = true;
-                }
-            }            
-            else if (m_l.m_l >= 5)
-            {
-                std::vector<Loc> level8Locs;
-                m_l.GetChildrenAtLevel(8, level8Locs);
-                std::string strval;
-                std::vector<std::vector<PartInst>> partsVec;
-                size_t totalCt = 0;
-                Point3f parentCenter = m_l.GetCenter();
-                for (auto& cl : level8Locs)
-                {
-                    if (pWorld->Level()->GetOctChunk(ILevel::OctKey(cl, 0), &strval))
-                    {
-                        partsVec.push_back(std::vector<PartInst>());
-                        std::vector<PartInst>& parts = partsVec.back();
-                        Point3f childCenter = cl.GetCenter();
-                        size_t partsCt = strval.size() / sizeof(PartInst);
-                        totalCt += partsCt;
-                        parts.resize(partsCt);
-                        memcpy(parts.data(), strval.data(), strval.size());
-                        for (auto& part : parts)
-                        {
-                            part.pos = (part.pos + childCenter) - parentCenter;
-                        }
-                    }
-                }
-                if (totalCt > 0)
-                {
-                    m_parts.resize(totalCt);
-                    PartInst *piPtr = m_parts.data();
-                    for (std::vector<PartInst>& parts : partsVec)
-                    {
-                        memcpy(piPtr, parts.data(), parts.size() * sizeof(PartInst));
-                        piPtr += parts.size();
-                    }
-                    for (auto& part : m_parts)
-                    {
-                        m_bricks.push_back(BrickManager::Inst().GetBrick(part.id));
-                    }
-                    m_readyState = 3;
-                    m_needsRefresh = true;
-                }
-            }
+            bricks.push_back(BrickManager::Inst().GetBrickAsync(part.id, detail));
         }
-        if (m_readyState == 1)
-        {        
-            m_readyState = 2;
+        for (auto& brick : bricks)
+        {
+            loaded.bricks.push_back(brick.Get());
         }
+    }
+
+    bool OctTile::AcceptLoaded()
+    {
+        std::unique_ptr<LoadedParts> loaded = TakeLoaded();
+        if (loaded == nullptr)
+            return false;
+        m_parts = std::move(loaded->parts);
+        m_bricks = std::move(loaded->bricks);
+        RebuildPartIndex();
+        m_needsRefresh = true;
+        // Nothing to build for an empty tile, and empty tiles aren't drawn.
+        if (m_parts.size() == 0)
+            SetGpuReady();
+        return true;
+    }
 
-        if (m_readyState == 2)
+    void OctTile::Refresh()
+    {
+
+    }
+
+    void OctTile::IndexPart(size_t idx)
+    {
+        const PartInst& part = m_parts[idx];
+        const Brick& brick = *m_bricks[idx];
+        AABoxf cb = brick.m_collisionBox;
+        cb.mMin = cb.mMin * BrickManager::Scale;
+        cb.mMax = cb.mMax * BrickManager::Scale;
+        cb = RotateAABox(cb, part.rot);
+        cb.mMin += part.pos;
+        cb.mMax += part.pos;
+        AABoxf bounds = brick.m_bounds;
+        bounds.mMin = bounds.mMin * BrickManager::Scale + part.pos;
+        bounds.mMax = bounds.mMax * BrickManager::Scale + part.pos;
+        m_partIndex.Add(cb, bounds);
+    }
+
+    void OctTile::RebuildPartIndex()
+    {
+        m_partIndex.Reset(m_l.GetExtent());
+        // Handles from before a reload don't match the new parts.
+        for (uint32_t slot : m_partSlots)
+        {
+            m_slots[slot].generation++;
+            m_freeSlots.push_back(slot);
+        }
+        m_partSlots.clear();
+        for (size_t idx = 0; idx < m_parts.size(); ++idx)
         {
-            m_readyState = 3;
+            IndexPart(idx);
+            AddPartSlot();
         }
+    }
 
-        return m_readyState == 3;
+    // Gives the last part in m_parts a slot.
+    void OctTile::AddPartSlot()
+    {
+        uint32_t slot;
+        if (m_freeSlots.size() > 0)
+        {
+            slot = m_freeSlots.back();
+            m_freeSlots.pop_back();
+        }
+        else
+        {
+            slot = (uint32_t)m_slots.size();
+            m_slots.push_back(PartSlot{ 0, 0 });
+        }
+        m_slots[slot].index = (uint32_t)(m_parts.size() - 1);
+        m_partSlots.push_back(slot);
     }
 
-    void OctTile::Refresh()
+    // Swaps the last part into idx, so handles and the index stay O(1).
+    void OctTile::RemovePartAt(size_t idx)
     {
+        uint32_t slot = m_partSlots[idx];
+        m_slots[slot].generation++;
+        m_freeSlots.push_back(slot);
+
+        m_parts[idx] = m_parts.back();
+        m_parts.pop_back();
+        m_bricks[idx] = m_bricks.back();
+        m_bricks.pop_back();
+        m_partSlots[idx] = m_partSlots.back();
+        m_partSlots.pop_back();
+        if (idx < m_partSlots.size())
+            m_slots[m_partSlots[idx]].index = (uint32_t)idx;
+        m_partIndex.RemoveSwap(idx);
+        m_needsPersist = true;
+        m_needsRefresh = true;
+    }
 
+    PartHandle OctTile::GetPartHandle(size_t idx) const
+    {
+        uint32_t slot = m_partSlots[idx];
+        return PartHandle{ slot, m_slots[slot].generation };
     }
 
     extern Loc g_hitLoc;
@@ -204,18 +245,21 @@ namespace sam
         {
             SceneGroup::Decomission(ctx);
             Clear();
-            for (auto& part : m_parts)
+            for (size_t idx = 0; idx < m_parts.size(); ++idx)
             {
-                auto brick = std::make_shared<LegoBrick>(part, part.atlasidx, m_l.m_l == 8,
+                const PartInst& part = m_parts[idx];
+                auto brick = std::make_shared<LegoBrick>(part, part.atlasidx, DetailForLevel(m_l.m_l),
                     m_l.m_l == 8 ? (
                     part.connected ? LegoBrick::Physics::Static : LegoBrick::Physics::Dynamic) :
                     LegoBrick::Physics::None,
                     false);
                 brick->SetOffset(part.pos);
                 brick->SetRotate(part.rot);
+                brick->SetTilePart(m_l, GetPartHandle(idx));
                 AddItem(brick);
             }
             m_needsRefresh = false;
+            SetGpuReady();
         }
         
         if (ctx.debugDraw == 2)
@@ -255,14 +299,15 @@ namespace sam
 
     void OctTile::Persist(World *pWorld)
     {
-        pWorld->Level()->WriteOctChunk(ILevel::OctKey(m_l, 0), (const char*)m_parts.data(), m_parts.size() *
-            sizeof(PartInst));
+        std::string chunk;
+        PartChunk::Encode(m_parts, &chunk);
+        pWorld->Level()->WriteOctChunk(ILevel::OctKey(m_l, 0), chunk.data(), chunk.size());
         m_needsPersist = false;
     }
     void OctTile::Decomission(DrawContext& ctx)
     {
         SceneGroup::Decomission(ctx);
-        m_readyState = 0;
+        m_state = State::Decommissioned;
         m_isdecommissioned = true;
     }
 
@@ -300,70 +345,54 @@ namespace sam
 
     void OctTile::GetInterectingParts(const Spheref& sphere, std::vector<PartInst>& piList)
     {
-        auto itBrick = m_bricks.begin();
-        auto itPart = m_parts.begin();
-        for (; itPart != m_parts.end(); ++itPart, ++itBrick)
-        {
-            AABox cb = (*itBrick)->m_bounds;
-            cb.mMin = cb.mMin * BrickManager::Scale + itPart->pos;
-            cb.mMax = cb.mMax * BrickManager::Scale + itPart->pos;
-            if (intersect(sphere, cb))
-                piList.push_back(*itPart);
-        }
+        Vec3f r(sphere.getRadius(), sphere.getRadius(), sphere.getRadius());
+        AABoxf sphereBox(sphere.getCenter() - r, sphere.getCenter() + r);
+        m_partIndex.ForEachNear(sphereBox, [&](size_t idx)
+            {
+                if (intersect(sphere, m_partIndex.Bounds(idx)))
+                    piList.push_back(m_parts[idx]);
+                return true;
+            });
     }
 
     bool OctTile::CanAddPart(const PartInst& pi, const AABoxf& bbox)
     {
-        auto itBrick = m_bricks.begin();
-        auto itPart = m_parts.begin();
-        for (; itPart != m_parts.end(); ++itPart, ++itBrick)
-        {
-            AABox cb = (*itBrick)->m_collisionBox;
-            cb.mMin = cb.mMin * BrickManager::Scale; 
-            cb.mMax = cb.mMax * BrickManager::Scale; 
-            cb = RotateAABox(cb, itPart->rot);
-            cb.mMin += itPart->pos;
-            cb.mMax += itPart->pos;
-            if (intersectepsilon(bbox, cb))
-                return false;
-        }
-        return true;
+        return m_partIndex.ForEachNear(bbox, [&](size_t idx)
+            {
+                return !intersectepsilon(bbox, m_partIndex.CollisionBox(idx));
+            });
     }
 
     void OctTile::AddPartInst(const PartInst& pi)
     {
         m_parts.push_back(pi);
         m_bricks.push_back(BrickManager::Inst().GetBrick(pi.id));
+        IndexPart(m_parts.size() - 1);
+        AddPartSlot();
         m_needsPersist = true;
         m_needsRefresh = true;
     }
     
     void OctTile::RemovePart(const PartInst& pi)
     {
-        bool removed = false;
-        auto itBrick = m_bricks.begin();
-        for (auto itPart = m_parts.begin(); itPart != m_parts.end();
-            )
+        for (size_t idx = 0; idx < m_parts.size(); )
         {
-            if (itPart->id == pi.id && itPart->pos == pi.pos)
-            {
-                removed = true;
-                itPart = m_parts.erase(itPart);
-                itBrick = m_bricks.erase(itBrick);
-            }
+            if (m_parts[idx].id == pi.id && m_parts[idx].pos == pi.pos)
+                RemovePartAt(idx);
             else
-            {
-                ++itPart;
-                ++itBrick;
-            }
-        }
-        if (removed)
-        {
-            m_needsPersist = true;
-            m_needsRefresh = true;
+                ++idx;
         }
     }
 
+    bool OctTile::RemovePart(const PartHandle& handle)
+    {
+        if (handle.slot >= m_slots.size() ||
+            m_slots[handle.slot].generation != handle.generation)
+            return false;
+        RemovePartAt(m_slots[handle.slot].index);
+        return true;
+    }
+
     OctTile::~OctTile()
     {
     }
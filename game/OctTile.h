@@ -6,6 +6,8 @@
 #include "Loc.h"
 #include "PartDefs.h"
 #include "gmtl/Sphere.h"
+#include "TileLoader.h"
+#include "PartIndex.h"
 
 struct VoxCube;
 
@@ -18,17 +20,16 @@ namespace sam
     {
         int partIdx;
     };
-    class OctTile : public SceneGroup
+    // Loading goes through TileLoad, which leaves m_parts and m_bricks to
+    // the main thread.
+    class OctTile : public SceneGroup, public TileLoad
     {
-        
         int m_image;
         Vec2f m_vals;
-        Loc m_l;
         Vec2f m_maxdh;
         Vec2f m_mindh;
         int m_texpingpong;
         int m_buildFrame;
-        int m_readyState;
         bgfxh<bgfx::UniformHandle> m_uparams;
 
         int m_lastUsedRawData;
@@ -36,6 +37,17 @@ namespace sam
         bool m_isdecommissioned;
         std::vector<PartInst> m_parts;
         std::vector<std::shared_ptr<Brick>> m_bricks;
+        // Boxes of m_parts, by the same index.
+        PartIndex m_partIndex;
+        // Slot map from PartHandle to m_parts index.
+        struct PartSlot
+        {
+            uint32_t index;
+            uint32_t generation;
+        };
+        std::vector<PartSlot> m_slots;
+        std::vector<uint32_t> m_partSlots;
+        std::vector<uint32_t> m_freeSlots;
         bool m_needsPersist;
         bool m_needsRefresh;
 
@@ -46,18 +58,24 @@ namespace sam
         float distFromCam;
     protected:
         void Refresh();
+        void IndexPart(size_t idx);
+        void RebuildPartIndex();
+        void AddPartSlot();
+        void RemovePartAt(size_t idx);
+        // Resolves the bricks of the parts on the loader thread.
+        void OnFetched(const PacketBuffer& buf, LoadedParts& loaded) override;
     public:
         void Draw(DrawContext& ctx) override;
         OctTile(const Loc& l);
         ~OctTile();
 
-        bool BackgroundLoad(World* pWorld);
+        // Main thread.  Moves decoded parts into the tile, true if there were any.
+        bool AcceptLoaded();
         bool IsEmpty() const;
 
         void SetIntersects(float i)
         { m_intersects = i; }
 
-        const Loc& GetLoc() const { return m_l; }
         void SetImage(int image)
         {
             m_image = image;
@@ -71,11 +89,12 @@ namespace sam
         void LoadVB();
         bool IsCollided(Point3f &oldpos, Point3f &newpos, AABoxf& bbox, Vec3f& outNormal);
         static Vec3i FindHit(const std::vector<byte> &data, const Vec3i p1, const Vec3i p2);
-        int GetReadyState() const
-        { return m_readyState; }
         void AddPartInst(const PartInst& pi);
         bool CanAddPart(const PartInst& pi, const AABoxf& bbox);
         void RemovePart(const PartInst& pi);
+        // Returns false if the part was already removed or reloaded.
+        bool RemovePart(const PartHandle& handle);
+        PartHandle GetPartHandle(size_t idx) const;
         void GetInterectingParts(const Spheref& sphere, std::vector<PartInst>& piList);
         
         void Persist(World* pWorld);
@@ -2,6 +2,7 @@
 #include "OctTileSelection.h"
 #include "Application.h"
 #include "Engine.h"
+#include "World.h"
 #include <numeric>
 #include "Mesh.h"
 #include "gmtl/PlaneOps.h"
@@ -9,6 +10,7 @@
 #include <sstream>
 #include "gmtl/Ray.h"
 #include "gmtl/Sphere.h"
+#include <chrono>
 #define NOMINMAX
 #ifdef _WIN32
 #include <Windows.h>
@@ -24,238 +26,39 @@ namespace sam
     static bool doBreak = false;
     int g_numLod9 = 0;
     int g_behindViewer = 0;
+    float g_tilesCreatedPerSec = 0;
+    float g_tilesRevivedPerSec = 0;
+    float g_tilesDestroyedPerSec = 0;
+    float g_prefetchUsedPct = 0;
 
-    std::atomic<size_t> OctTileSelection::sNumTiles = 0;
-
-    class FrustumTiles
+    static double NowSeconds()
     {
+        return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
 
-        inline static float nearFrust = 0.1f;
-        inline static float farFrust = 150.0f;
-    public:
-        static void Get(Camera& cam, std::vector<Loc>& locs, float pixelDist, int maxlod, const AABoxf& playerBounds)
-        {
-            Frustumf viewFrust = cam.GetFrustum(nearFrust, farFrust);
-            Matrix44f viewproj = cam.GetPerspectiveMatrix(nearFrust, farFrust) * cam.ViewMatrix();
-            auto& fly = cam.GetFly();
-            Vec3f r, u, f;
-            fly.GetDirs(r, u, f);
-            g_behindViewer = 0;
-            GetLocsInView(locs, Loc(0, 0, 0, 0), viewFrust, viewproj, fly.pos, r, f, pixelDist, maxlod, playerBounds, true);
-            g_numLod9 = 0;
-            for (auto& tile : locs)
-            {
-                g_numLod9 += tile.m_l == 8 ? 1 : 0;
-            }
-        }
-
-    private:
-
-
-        enum class ContainmentType
-        {
-            Disjoint = 0,
-            Contains = 1,
-            Intersects = 2
-        };
-
-        static Vec3f FrustumCenter(Matrix44f viewproj)
-        {
-            invert(viewproj);
-            Vec4f inpt4;
-            xform(inpt4, viewproj, Vec4f(0, 0, 0.5f, 1.0f));
-            inpt4 /= inpt4[3];
-            return Vec3f(inpt4[0], inpt4[1], inpt4[2]);
-        }
-
-
-        template< class DATA_TYPE >
-        DATA_TYPE static abs_distance(const Plane<DATA_TYPE>& plane, const Point<DATA_TYPE, 3>& pt)
-        {
-            return (dot(plane.mNorm, static_cast<Vec<DATA_TYPE, 3>>(pt)) + plane.mOffset);
-        }
-
-
-        static ContainmentType Contains(const Frustumf& f, AABoxf box)
-        {
-            ContainmentType result = ContainmentType::Contains;
-            for (int i = 0; i < 6; i++)
-            {
-                Planef plane = f.mPlanes[i];
-
-                // Approach: http://zach.in.tu-clausthal.de/teaching/cg_literatur/lighthouse3d_view_frustum_culling/index.html
-
-                Point3f positive = Point3f(box.mMin[0], box.mMin[1], box.mMin[2]);
-                Point3f negative = Point3f(box.mMax[0], box.mMax[1], box.mMax[2]);
-
-                if (plane.mNorm[0] >= 0)
-                {
-                    positive[0] = box.mMax[0];
-                    negative[0] = box.mMin[0];
-                }
-                if (plane.mNorm[1] >= 0)
-                {
-                    positive[1] = box.mMax[1];
-                    negative[1] = box.mMin[1];
-                }
-                if (plane.mNorm[2] >= 0)
-                {
-                    positive[2] = box.mMax[2];
-                    negative[2] = box.mMin[2];
-                }
-
-                // If the positive vertex is outside (behind plane), the box is disjoint.
-                float positiveDistance = abs_distance(plane, positive);
-                if (positiveDistance < 0)
-                {
-                    return ContainmentType::Disjoint;
-                }
-
-                // If the negative vertex is outside (behind plane), the box is intersecting.
-                // Because the above check failed, the positive vertex is in front of the plane,
-                // and the negative vertex is behind. Thus, the box is intersecting this plane.
-                float negativeDistance = abs_distance(plane, negative);
-                if (negativeDistance < 0)
-                {
-                    result = ContainmentType::Intersects;
-                }
-            }
-
-            return result;
-        }
-
-
-        static inline void GetCorners(const AABoxf& box, Point3f pts[8])
-        {
-            const Point3f& l = box.mMin;
-            const Point3f& u = box.mMax;
-            pts[0] = Point3f(l[0], l[1], l[2]);
-            pts[1] = Point3f(l[0], l[1], u[2]);
-            pts[2] = Point3f(l[0], u[1], l[2]);
-            pts[3] = Point3f(l[0], u[1], u[2]);
-            pts[4] = Point3f(u[0], l[1], l[2]);
-            pts[5] = Point3f(u[0], l[1], u[2]);
-            pts[6] = Point3f(u[0], u[1], l[2]);
-            pts[7] = Point3f(u[0], u[1], u[2]);
-        }
-
-        static inline float clampf(float v, float vmin, float vmax)
-        {
-            return std::max(vmin, std::min(vmax, v));
-        }
-        static float DistanceToAAbb(const Point3f& v, const AABoxf& bbox)
-        {
-            Point3f closestpt(clampf(v[0], bbox.mMin[0], bbox.mMax[0]),
-                clampf(v[1], bbox.mMin[1], bbox.mMax[1]),
-                clampf(v[2], bbox.mMin[2], bbox.mMax[2]));
-            Vec3f closestVec = v - closestpt;
-            return length(closestVec);
-        }
-
-    public:
-
-        static int TargetLodForLoc(const Loc& curLoc, const Matrix44f& viewProj, const Vec3f &camFwd, const Point3f &camPos)
-        {
-            Point3f c[8];
-            const AABoxf& bbox = curLoc.GetBBox();
-            GetCorners(bbox, c);
-            float extents = bbox.mMax[0] - bbox.mMin[0];
-            float sq = extents / OctTile::SquarePtsCt;
-
-            for (int i = 0; i < 8; ++i)
-            {
-                Point3f tp0(c[i][0], c[i][1], c[i][2]);
-                float v = dot((tp0 - camPos), camFwd);
-                if (v < 0)
-                    return -1;
-            }
-
-            float maxlen = 0;
-            for (int i = 0; i < 8; ++i)
-            {
-                Point4f tp0(c[i][0], c[i][1], c[i][2], 1), sp0, sp1;
-                xform(sp0, viewProj, tp0);
-                sp0 /= sp0[3];
-
-                Point4f tp1(c[i][0] + sq, c[i][1] + sq, c[i][2] + sq, 1);
-                xform(sp1, viewProj, tp1);
-                sp1 /= sp1[3];
-
-                
-                maxlen = std::max(maxlen, lengthSquared(Vec2f(sp1[0] - sp0[0], sp1[1] - sp0[1])));
-            }
-
-            return std::max(log2(maxlen) + 9, 0.0f);
-        }
-
-        static int TargetLodForLoc2(const Loc& curLoc, const Point3f& camPos)
-        {
-            float dist = DistanceToAAbb(camPos, curLoc.GetBBox());
-            if (dist == 0)
-                return -1;
-            return (int)9 - log10(dist);
-        }
-
-
-        static bool GetLocsInView(std::vector<Loc>& locs, const Loc& curLoc,
-            const Frustumf& frustum, const Matrix44f& viewProj, const Point3f& camPos, const Vec3f& camRight, const Vec3f& camFwd, float pixelDist, int maxlod, const AABoxf& playerBounds, bool behindCamera)
-        {
-            static int minLod = -1;
-            static bool dobreak = false;
-            //int targetLod = TargetLodForLoc(curLoc, viewProj, camFwd, camPos);
-            int targetLod = TargetLodForLoc2(curLoc, camPos);
-            //if (dobreak && curLoc == Loc(64, 64, 64, 7))
-            //    __debugbreak();
-            if (targetLod >= 0)
-            {
-               
-                if (curLoc.m_l >= targetLod)
-                {
-                    locs.push_back(curLoc);
-                    return true;
-                }
-            }
-            if (targetLod < 0 && curLoc.m_l == maxlod &&
-                curLoc.m_l > minLod)
-            {
-                locs.push_back(curLoc);
-                return true;
-            }
-
-            bool hasChildren = false;
-            if (curLoc.m_l < maxlod)
-            {
-                std::vector<Loc> fillLocs;
-                fillLocs.reserve(8);
-
-                std::vector<Loc> children = curLoc.GetChildren();
-                for (const Loc& childLoc : children)
-                {
-                    AABoxf cbox = childLoc.GetBBox();
-                    ContainmentType res = Contains(frustum, cbox);
-                    bool intersectsPlayer = intersect(playerBounds, cbox);
-                    if (res != ContainmentType::Disjoint || intersectsPlayer)
-                    {
-                        bool childExists = GetLocsInView(locs, childLoc, frustum, viewProj, camPos, camRight, camFwd, pixelDist, maxlod, playerBounds, targetLod < 0);
-                        hasChildren |= childExists;
-                        if (!childExists)
-                            fillLocs.push_back(childLoc);
-                    }
-                }
-
-                if (hasChildren)
-                {
-                    locs.insert(locs.end(), fillLocs.begin(), fillLocs.end());
-                }
-            }
-            return hasChildren;
-        }
-    };
+    std::atomic<size_t> OctTileSelection::sNumTiles = 0;
 
+    static TileView ViewFromCamera(const Camera& cam)
+    {
+        TileView view;
+        const Camera::Fly& fly = cam.GetFly();
+        view.pos = fly.pos;
+        fly.GetDirs(view.dirs[0], view.dirs[1], view.dirs[2]);
+        view.proj = cam.GetPerspectiveMatrix(FrustumTiles::NearDist, FrustumTiles::FarDist);
+        view.frustum = cam.GetFrustum(FrustumTiles::NearDist, FrustumTiles::FarDist);
+        return view;
+    }
 
     OctTileSelection::OctTileSelection() :
-        m_exit(false),
-        m_loaderThread(LoaderThread, this)
+        m_tilesCreated(0),
+        m_tilesRevived(0),
+        m_tilesDestroyed(0),
+        m_churnStart(NowSeconds()),
+        m_lastCamPos(0, 0, 0),
+        m_camVelocity(0, 0, 0),
+        m_lastUpdate(0),
+        m_prefetchHorizon(1.5f),
+        m_pWorld(nullptr)
     {
         m_nearfarmid[0] = 0.1f;
         m_nearfarmid[1] = 25.0f;
@@ -263,33 +66,6 @@ namespace sam
     }
 
 
-    void OctTileSelection::LoaderThread(void* arg)
-    {
-        OctTileSelection* pThis = (OctTileSelection*)arg;
-        std::unique_lock<std::mutex> lk(pThis->m_mtxcv);
-        while (!pThis->m_exit)
-        {
-            pThis->m_cv.wait(lk);
-            if (pThis->m_exit)
-                break;
-            while (pThis->m_loaderTiles.size() > 0)
-            {
-                std::shared_ptr<OctTile> tile;
-                {
-                    std::lock_guard(pThis->m_mtx);
-                    if (pThis->m_loaderTiles.size() > 0)
-                    {
-                        tile = pThis->m_loaderTiles.back();
-                        pThis->m_loaderTiles.pop_back();
-                    }
-                }
-                if (tile != nullptr && tile->GetReadyState() < 3)
-                    tile->BackgroundLoad(pThis->m_pWorld);
-            }
-        }
-    }
-
-
     void OctTileSelection::GetLocDistance(const Loc& loc, const Point3f& campos, const Vec3f& camdir,
         float& neardist, float& middist, float& fardist)
     {
@@ -322,65 +98,211 @@ namespace sam
     extern int g_maxTileLod;
     void OctTileSelection::Update(Engine& e, DrawContext& ctx, const AABoxf& playerBounds)
     {
-        auto oldTiles = m_activeTiles;
-        m_activeTiles.clear();
         auto& cam = e.ViewCam();
         Camera::Fly fly = cam.GetFly();
         m_pWorld = ctx.m_pWorld;
-        std::vector<Loc> locs;
-        FrustumTiles::Get(cam, locs, 100.0f, g_maxTileLod, playerBounds);
-
-        std::sort(locs.begin(), locs.end());
-        std::vector<std::shared_ptr<OctTile>> loaderTiles;
-        for (const auto& l : locs)
+        std::vector<Loc> added, removed;
+        if (m_frustumTiles == nullptr)
+            m_frustumTiles = std::make_unique<FrustumTiles>();
+        m_frustumTiles->Update(ViewFromCamera(cam), g_maxTileLod, m_lodPolicy, playerBounds, added, removed);
+        double now = NowSeconds();
+        PollChangedTiles();
+
+        // A tile can move between being selected and being a fill in one
+        // update, so it is only let go if it ends up unused.
+        for (const auto& l : removed)
+        {
+            m_activeTiles.erase(l);
+            g_numLod9 -= l.m_l == 8 ? 1 : 0;
+        }
+        for (const auto& l : added)
         {
+            g_numLod9 += l.m_l == 8 ? 1 : 0;
             auto itSq = m_tiles.find(l);
             if (itSq == m_tiles.end())
             {
-                std::shared_ptr<OctTile> sq = std::make_shared<OctTile>(l);
-                { // Init OctTile
-                    float sx = l.m_x;
-                    float sy = l.m_z;
-
-                    Point3f pos = l.GetCenter();
-                    sq->SetOffset(pos);
+                std::shared_ptr<OctTile> sq;
+                auto itGrace = m_graceTiles.find(l);
+                if (itGrace != m_graceTiles.end())
+                {
+                    if (!itGrace->second.stale)
+                    {
+                        sq = itGrace->second.tile;
+                        m_tilesRevived++;
+                    }
+                    else
+                    {
+                        itGrace->second.tile->Decomission(ctx);
+                        m_tilesDestroyed++;
+                        sNumTiles--;
+                    }
+                    m_graceTiles.erase(itGrace);
+                }
+                if (sq == nullptr)
+                {
+                    sq = std::make_shared<OctTile>(l);
+                    { // Init OctTile
+                        Point3f pos = l.GetCenter();
+                        sq->SetOffset(pos);
+                    }
+                    m_tilesCreated++;
+                    sNumTiles++;
                 }
                 itSq = m_tiles.insert(std::make_pair(l, sq)).first;
-                sNumTiles++;
             }
-            if (itSq->second->GetReadyState() < 3)
-                loaderTiles.push_back(itSq->second);
             m_activeTiles.insert(l);
         }
-
+        for (const auto& l : removed)
         {
-            std::lock_guard grd(m_mtx);
-            std::swap(m_loaderTiles, loaderTiles);
+            if (m_activeTiles.find(l) != m_activeTiles.end())
+                continue;
+            auto itTile = m_tiles.find(l);
+            if (itTile == m_tiles.end())
+                continue;
+            std::shared_ptr<OctTile> tile = itTile->second;
+            m_tiles.erase(itTile);
+            m_graceTiles.insert(std::make_pair(l, GraceTile{ tile, now + m_lodPolicy.graceSeconds, false }));
+            m_graceOrder.push_back(std::make_pair(l, tile.get()));
         }
-        m_cv.notify_one();
-
-        for (auto loc : oldTiles)
-        {
-            if (m_activeTiles.find(loc) == m_activeTiles.end())
+        ExpireGraceTiles(ctx, now);
+        PrefetchAhead(cam, playerBounds, now);
+
+        if (now - m_churnStart >= 1.0)
+        {
+            float secs = (float)(now - m_churnStart);
+            g_tilesCreatedPerSec = m_tilesCreated / secs;
+            g_tilesRevivedPerSec = m_tilesRevived / secs;
+            g_tilesDestroyedPerSec = m_tilesDestroyed / secs;
+            m_tilesCreated = m_tilesRevived = m_tilesDestroyed = 0;
+            m_churnStart = now;
+            if (m_pWorld->Level() != nullptr)
             {
-                auto itTile = m_tiles.find(loc);
-                itTile->second->Decomission(ctx);
-                m_tiles.erase(itTile);
-                sNumTiles--;
+                ILevel::PrefetchStats stats = m_pWorld->Level()->GetPrefetchStats();
+                g_prefetchUsedPct = stats.requested > 0 ? stats.used * 100.0f / stats.requested : 0;
             }
         }
 
         Vec3f l, u, f;
         fly.GetDirs(l, u, f);
+        std::vector<TileLoader::Request> loaderTiles;
         for (auto loc : m_activeTiles)
         {
             auto itSq = m_tiles.find(loc);
+            itSq->second->AcceptLoaded();
+            if (itSq->second->GetState() == OctTile::State::Queued)
+                loaderTiles.push_back(TileLoader::Request{ LoadPriority(loc, fly.pos), itSq->second });
 
             GetLocDistance(loc, fly.pos, f,
                 itSq->second->m_nearDist,
                 itSq->second->distFromCam,
                 itSq->second->m_farDist);
         }
+
+        // Nothing to load from until a level is open.
+        if (m_pWorld->Level() != nullptr)
+            m_loader.SetRequests(m_pWorld->Level(), loaderTiles);
+    }
+
+    void OctTileSelection::PrefetchAhead(Camera& cam, const AABoxf& playerBounds, double now)
+    {
+        Camera::Fly fly = cam.GetFly();
+        double dt = now - m_lastUpdate;
+        Vec3f delta = fly.pos - m_lastCamPos;
+        m_lastCamPos = fly.pos;
+        m_lastUpdate = now;
+        // Stalls and teleports say nothing about where the camera is going.
+        if (dt <= 0 || dt > 0.5 || length(delta) > 100.0f)
+        {
+            m_camVelocity = Vec3f(0, 0, 0);
+            return;
+        }
+        float blend = std::min((float)dt / 0.25f, 1.0f);
+        Vec3f velocity = delta / (float)dt;
+        m_camVelocity += (velocity - m_camVelocity) * blend;
+
+        Vec3f ahead = m_camVelocity * m_prefetchHorizon;
+        if (length(ahead) < 1.0f || m_pWorld->Level() == nullptr)
+            return;
+
+        fly.pos += ahead;
+        Camera predicted = cam;
+        predicted.SetFly(fly);
+        AABoxf bounds(playerBounds.mMin + ahead, playerBounds.mMax + ahead);
+        if (m_prefetchTiles == nullptr)
+            m_prefetchTiles = std::make_unique<FrustumTiles>();
+        std::vector<Loc> added, removed;
+        m_prefetchTiles->Update(ViewFromCamera(predicted), g_maxTileLod, m_lodPolicy, bounds, added, removed);
+        for (const auto& l : removed)
+            m_predictedTiles.erase(l);
+        for (const auto& l : added)
+            m_predictedTiles.insert(l);
+
+        // Only tiles that load from the server, and that we don't have yet.
+        std::vector<std::pair<float, Loc>> wanted;
+        for (const Loc& l : m_predictedTiles)
+        {
+            if (l.m_l >= 5 && m_tiles.find(l) == m_tiles.end() &&
+                m_graceTiles.find(l) == m_graceTiles.end())
+                wanted.push_back(std::make_pair(LoadPriority(l, fly.pos), l));
+        }
+        if (wanted.size() == 0)
+            return;
+        std::sort(wanted.begin(), wanted.end(), [](const auto& a, const auto& b)
+            { return a.first > b.first; });
+        std::vector<ILevel::OctKey> keys;
+        keys.reserve(wanted.size());
+        for (const auto& w : wanted)
+            keys.push_back(ILevel::OctKey(w.second, 0));
+        m_pWorld->Level()->Prefetch(keys);
+    }
+
+    void OctTileSelection::ExpireGraceTiles(DrawContext& ctx, double now)
+    {
+        while (!m_graceOrder.empty())
+        {
+            const auto& [l, pTile] = m_graceOrder.front();
+            auto itGrace = m_graceTiles.find(l);
+            // Revived, or revived and let go again with a newer entry.
+            if (itGrace == m_graceTiles.end() || itGrace->second.tile.get() != pTile)
+            {
+                m_graceOrder.pop_front();
+                continue;
+            }
+            if (itGrace->second.expires > now && m_graceTiles.size() <= m_lodPolicy.graceMaxTiles)
+                break;
+            itGrace->second.tile->Decomission(ctx);
+            m_graceTiles.erase(itGrace);
+            m_graceOrder.pop_front();
+            m_tilesDestroyed++;
+            sNumTiles--;
+        }
+    }
+
+    void OctTileSelection::MarkGraceTilesStale(const Loc& l)
+    {
+        // Coarser tiles are aggregates that include this one's parts.
+        for (int lvl = 0; lvl <= l.m_l; ++lvl)
+        {
+            auto itGrace = m_graceTiles.find(l.ParentAtLevel(lvl));
+            if (itGrace != m_graceTiles.end())
+                itGrace->second.stale = true;
+        }
+    }
+
+    void OctTileSelection::PollChangedTiles()
+    {
+        if (m_pWorld->Level() == nullptr)
+            return;
+        // The level drops its cached copy on its own, but a grace tile still
+        // holds the parts from before the edit.
+        std::vector<ILevel::OctKey> changed;
+        if (!m_pWorld->Level()->TakeChangedKeys(&changed))
+        {
+            for (auto& pair : m_graceTiles)
+                pair.second.stale = true;
+        }
+        for (const ILevel::OctKey& key : changed)
+            MarkGraceTilesStale(key.GetLoc());
     }
 
     int g_nearTiles;
@@ -462,17 +384,61 @@ namespace sam
 
     std::shared_ptr<OctTile> OctTileSelection::TileFromPos(const Point3f& pos)
     {
-        for (auto& pair : m_tiles)
+        // Coarsest tile first.
+        for (int l = 0; l <= Loc::lsize; ++l)
         {
-            if (intersect(pair.first.GetBBox(), pos))
-            {
-                return pair.second;
-            }
+            auto itTile = m_tiles.find(Loc::FromPoint(pos, l));
+            if (itTile != m_tiles.end())
+                return itTile->second;
         }
 
         return nullptr;
     }
 
+    // Calls f for each resident tile whose bbox intersects box, including
+    // tiles that only touch it.
+    template <typename F> static void ForEachTileInBox(LocMap<std::shared_ptr<OctTile>>& tiles,
+        const AABoxf& box, F f)
+    {
+        for (int l = 0; l <= Loc::lsize; ++l)
+        {
+            float extent = Loc(0, 0, 0, l).GetExtent();
+            const int origin[3] = { Loc::ox, Loc::oy, Loc::oz };
+            int lo[3], hi[3];
+            size_t count = 1;
+            for (int i = 0; i < 3; ++i)
+            {
+                lo[i] = std::max((int)ceilf((box.mMin[i] - origin[i]) / extent) - 1, 0);
+                hi[i] = std::min((int)floorf((box.mMax[i] - origin[i]) / extent), (1 << l) - 1);
+                count *= hi[i] >= lo[i] ? hi[i] - lo[i] + 1 : 0;
+            }
+            if (count == 0)
+                continue;
+            // A big box at a fine level covers more cells than there are tiles.
+            if (count > tiles.size())
+            {
+                for (auto& pair : tiles)
+                {
+                    if (pair.first.m_l == l && intersect(box, pair.first.GetBBox()))
+                        f(pair.first, pair.second);
+                }
+                continue;
+            }
+            for (int x = lo[0]; x <= hi[0]; ++x)
+            {
+                for (int y = lo[1]; y <= hi[1]; ++y)
+                {
+                    for (int z = lo[2]; z <= hi[2]; ++z)
+                    {
+                        auto itTile = tiles.find(Loc(x, y, z, l));
+                        if (itTile != tiles.end())
+                            f(itTile->first, itTile->second);
+                    }
+                }
+            }
+        }
+    }
+
     struct IntersectTile
     {
         float dist;
@@ -485,50 +451,49 @@ namespace sam
     bool OctTileSelection::CanAddPart(const PartInst& pi, const AABoxf &inBbox)
     {
         bool canAdd = true;
-        for (auto& pair : m_tiles)
-        {
-            if (pair.second->IsEmpty())
-                continue;
-            AABoxf bbox = pair.first.GetBBox();
-            if (intersect(inBbox, bbox))
+        ForEachTileInBox(m_tiles, inBbox, [&](const Loc& l, const std::shared_ptr<OctTile>& tile)
             {
+                if (tile->IsEmpty())
+                    return;
+                AABoxf bbox = l.GetBBox();
                 PartInst p2 = pi;
                 Point3f cpos = (bbox.mMin + bbox.mMax) * 0.5f;
                 p2.pos -= cpos;
                 AABoxf bbox2 = inBbox;
                 bbox2.mMin -= cpos;
                 bbox2.mMax -= cpos;
-                canAdd &= pair.second->CanAddPart(p2, bbox2);
-            }
-        }
+                canAdd &= tile->CanAddPart(p2, bbox2);
+            });
         return canAdd;
     }
     
     void OctTileSelection::GetInterectingParts(const Spheref& sphere, std::vector<PartInst>& piList)
     {
-        for (auto& pair : m_tiles)
-        {
-            if (pair.second->IsEmpty())
-                continue;
-            AABoxf bbox = pair.first.GetBBox();
-            if (intersect(sphere, bbox))
+        Vec3f r(sphere.getRadius(), sphere.getRadius(), sphere.getRadius());
+        AABoxf sphereBox(sphere.getCenter() - r, sphere.getCenter() + r);
+        ForEachTileInBox(m_tiles, sphereBox, [&](const Loc& l, const std::shared_ptr<OctTile>& tile)
             {
+                if (tile->IsEmpty())
+                    return;
+                AABoxf bbox = l.GetBBox();
+                if (!intersect(sphere, bbox))
+                    return;
                 Point3f cpos = (bbox.mMin + bbox.mMax) * 0.5f;
                 Spheref cs(sphere.getCenter() - cpos, sphere.getRadius());
                 std::vector<PartInst> piTileList;
-                pair.second->GetInterectingParts(cs, piTileList);
+                tile->GetInterectingParts(cs, piTileList);
                 for (PartInst& piTile : piTileList)
                 {
                     piTile.pos += cpos;
                     piList.push_back(piTile);
                 }
-            }
-        }
+            });
     }
 
     void OctTileSelection::AddPartInst(const PartInst& pi)
     {
         Loc l = Loc::FromPoint<8>(pi.pos);
+        MarkGraceTilesStale(l);
         auto itTile = m_tiles.find(l);
         if (itTile != m_tiles.end())
         {
@@ -545,6 +510,7 @@ namespace sam
         for (const PartInst& pi : piList)
         {
             Loc l = Loc::FromPoint<8>(pi.pos);
+            MarkGraceTilesStale(l);
             auto itTile = partsPerTile.find(l);
             if (itTile == partsPerTile.end())
             {
@@ -569,7 +535,12 @@ namespace sam
             else
             {
                 std::shared_ptr<OctTile> sq = std::make_shared<OctTile>(pair.first);
-                while (!sq->BackgroundLoad(pWorld)) {}
+                // Load what is already stored so the persist below adds to
+                // it, and leave the tile alone if that fails rather than
+                // overwrite it.
+                if (!sq->BackgroundLoad(pWorld->Level(), true))
+                    continue;
+                sq->AcceptLoaded();
                 for (const PartInst& pi : pair.second)
                 {
                     PartInst p2 = pi;
@@ -583,6 +554,7 @@ namespace sam
     void OctTileSelection::RemovePart(const PartInst& pi)
     {
         Loc l = Loc::FromPoint<8>(pi.pos);
+        MarkGraceTilesStale(l);
         auto itTile = m_tiles.find(l);
         if (itTile != m_tiles.end())
         {
@@ -593,6 +565,18 @@ namespace sam
         }
     }
 
+    bool OctTileSelection::RemovePart(const Loc& tileLoc, const PartHandle& handle)
+    {
+        // Only level 8 tiles are edited, coarser ones are built from them.
+        if (tileLoc.m_l != 8)
+            return false;
+        auto itTile = m_tiles.find(tileLoc);
+        if (itTile == m_tiles.end() || !itTile->second->RemovePart(handle))
+            return false;
+        MarkGraceTilesStale(tileLoc);
+        return true;
+    }
+
     bool OctTileSelection::Intersects(const Point3f& pos, const Vec3f& ray, Loc& outloc, Vec3i& opt)
     {
         std::vector<IntersectTile> orderedTiles;
@@ -635,9 +619,6 @@ namespace sam
 
     OctTileSelection::~OctTileSelection()
     {
-        m_exit = true;
-        m_cv.notify_one();
-        m_loaderThread.join();
     }
 
 
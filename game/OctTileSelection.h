@@ -2,8 +2,10 @@
 #include <map>
 #include <set>
 #include "OctTile.h"
-#include <thread>
-#include <condition_variable>
+#include "LocMap.h"
+#include "FrustumTiles.h"
+#include "TileLoader.h"
+#include <deque>
 
 class SimplexNoise;
 namespace sam
@@ -12,24 +14,59 @@ namespace sam
     struct DrawContext;
     class Engine;
     class Touch;
+
     class OctTileSelection
     {
     public:
 
         static std::atomic<size_t> sNumTiles;
 
-        std::map<Loc, std::shared_ptr<OctTile>> m_tiles;
+        LocMap<std::shared_ptr<OctTile>> m_tiles;
         std::set<Loc> m_activeTiles;
-        std::vector<std::shared_ptr<OctTile>> m_loaderTiles;
 
-        std::thread m_loaderThread;
-        std::mutex m_mtx;
-        bool m_exit;
-        std::mutex m_mtxcv;
-        std::condition_variable m_cv;
-        World *m_pWorld;
+        // Persistent octree selection, reports which tiles changed each Update.
+        std::unique_ptr<FrustumTiles> m_frustumTiles;
+        LodPolicy m_lodPolicy;
+
+        struct GraceTile
+        {
+            std::shared_ptr<OctTile> tile;
+            double expires;
+            // Edited since it left, so it can't be reused.
+            bool stale;
+        };
+        // Recently deactivated tiles, and the order they expire in.  Entries
+        // in m_graceOrder whose tile was revived are skipped.
+        LocMap<GraceTile> m_graceTiles;
+        std::deque<std::pair<Loc, OctTile*>> m_graceOrder;
+        void ExpireGraceTiles(DrawContext& ctx, double now);
+        // After an edit at l, it and the tiles aggregating it can't be revived.
+        void MarkGraceTilesStale(const Loc& l);
+        // Marks grace tiles other clients have edited.
+        void PollChangedTiles();
 
-        static void LoaderThread(void* arg);
+        // Tile churn, reported per second.
+        int m_tilesCreated;
+        int m_tilesRevived;
+        int m_tilesDestroyed;
+        double m_churnStart;
+
+        // A second selection from where the camera is heading, so its tiles
+        // are fetched before they're needed.  The velocity is smoothed over
+        // recent frames.
+        std::unique_ptr<FrustumTiles> m_prefetchTiles;
+        std::set<Loc> m_predictedTiles;
+        Point3f m_lastCamPos;
+        Vec3f m_camVelocity;
+        double m_lastUpdate;
+        // Seconds ahead of the camera to prefetch.
+        float m_prefetchHorizon;
+        void PrefetchAhead(Camera& cam, const AABoxf& playerBounds, double now);
+
+        World *m_pWorld;
+        // Its queue is rebuilt every Update, so tiles that leave
+        // m_activeTiles drop out.  Declared last so its threads stop first.
+        TileLoader m_loader;
 
 
         void Update(Engine& e, DrawContext& ctx, const AABoxf &playerBounds);
@@ -46,6 +83,8 @@ namespace sam
         bool CanAddPart(const PartInst& pi, const AABoxf& bbox);
         void AddPartInst(const PartInst& pi);
         void RemovePart(const PartInst& pi);
+        // Removes a part of a resident level 8 tile, false if it isn't there.
+        bool RemovePart(const Loc& tileLoc, const PartHandle& handle);
         void GetInterectingParts(const Spheref& sphere, std::vector<PartInst>& piList);
 
         void AddMultipleParts(World* pWorld, const std::vector<PartInst>& piList);
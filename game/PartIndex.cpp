@@ -0,0 +1,175 @@
+#include "StdIncludes.h"
+#include "PartIndex.h"
+
+using namespace gmtl;
+
+namespace sam
+{
+    PartIndex::PartIndex() :
+        m_extent(1),
+        m_cellSize(1.0f / GridDim),
+        m_hasGrid(false),
+        m_visitStamp(0)
+    {
+    }
+
+    void PartIndex::Reset(float extent)
+    {
+        for (int i = 0; i < 3; ++i)
+        {
+            m_colMin[i].clear();
+            m_colMax[i].clear();
+            m_bndMin[i].clear();
+            m_bndMax[i].clear();
+        }
+        m_extent = extent;
+        m_cellSize = extent / GridDim;
+        m_hasGrid = false;
+        m_cells.clear();
+        m_large.clear();
+        m_visited.clear();
+    }
+
+    void PartIndex::Add(const AABoxf& collision, const AABoxf& bounds)
+    {
+        for (int i = 0; i < 3; ++i)
+        {
+            m_colMin[i].push_back(collision.mMin[i]);
+            m_colMax[i].push_back(collision.mMax[i]);
+            m_bndMin[i].push_back(bounds.mMin[i]);
+            m_bndMax[i].push_back(bounds.mMax[i]);
+        }
+        if (m_hasGrid)
+        {
+            m_visited.push_back(0);
+            GridInsert((uint32_t)size() - 1);
+        }
+        else if (size() >= GridMinParts)
+            BuildGrid();
+    }
+
+    void PartIndex::RemoveSwap(size_t idx)
+    {
+        size_t last = size() - 1;
+        if (m_hasGrid)
+        {
+            GridReplace((uint32_t)idx, UINT32_MAX);
+            if (idx != last)
+                GridReplace((uint32_t)last, (uint32_t)idx);
+            m_visited.pop_back();
+        }
+        for (int i = 0; i < 3; ++i)
+        {
+            for (std::vector<float>* v : { &m_colMin[i], &m_colMax[i], &m_bndMin[i], &m_bndMax[i] })
+            {
+                (*v)[idx] = (*v)[last];
+                v->pop_back();
+            }
+        }
+    }
+
+    AABoxf PartIndex::CollisionBox(size_t idx) const
+    {
+        return AABoxf(Point3f(m_colMin[0][idx], m_colMin[1][idx], m_colMin[2][idx]),
+            Point3f(m_colMax[0][idx], m_colMax[1][idx], m_colMax[2][idx]));
+    }
+
+    AABoxf PartIndex::Bounds(size_t idx) const
+    {
+        return AABoxf(Point3f(m_bndMin[0][idx], m_bndMin[1][idx], m_bndMin[2][idx]),
+            Point3f(m_bndMax[0][idx], m_bndMax[1][idx], m_bndMax[2][idx]));
+    }
+
+    AABoxf PartIndex::GridBox(size_t idx) const
+    {
+        AABoxf box;
+        for (int i = 0; i < 3; ++i)
+        {
+            box.mMin[i] = std::min(m_colMin[i][idx], m_bndMin[i][idx]);
+            box.mMax[i] = std::max(m_colMax[i][idx], m_bndMax[i][idx]);
+        }
+        box.setEmpty(false);
+        return box;
+    }
+
+    // Cells are clamped to the grid, so parts poking out of the tile land
+    // in the edge cells and queries outside it still find them.
+    bool PartIndex::CellRange(const AABoxf& box, int lo[3], int hi[3]) const
+    {
+        float half = m_extent * 0.5f;
+        for (int i = 0; i < 3; ++i)
+        {
+            lo[i] = std::clamp((int)floorf((box.mMin[i] + half) / m_cellSize), 0, GridDim - 1);
+            hi[i] = std::clamp((int)floorf((box.mMax[i] + half) / m_cellSize), 0, GridDim - 1);
+        }
+        return (hi[0] - lo[0] + 1) * (hi[1] - lo[1] + 1) * (hi[2] - lo[2] + 1) <= MaxCellsPerPart;
+    }
+
+    void PartIndex::GridInsert(uint32_t idx)
+    {
+        int lo[3], hi[3];
+        if (!CellRange(GridBox(idx), lo, hi))
+        {
+            m_large.push_back(idx);
+            return;
+        }
+        for (int x = lo[0]; x <= hi[0]; ++x)
+        {
+            for (int y = lo[1]; y <= hi[1]; ++y)
+            {
+                for (int z = lo[2]; z <= hi[2]; ++z)
+                    m_cells[CellKey(x, y, z)].push_back(idx);
+            }
+        }
+    }
+
+    // Renames idx to newIdx wherever the grid holds it, or drops it if
+    // newIdx is UINT32_MAX.
+    void PartIndex::GridReplace(uint32_t idx, uint32_t newIdx)
+    {
+        auto replace = [idx, newIdx](std::vector<uint32_t>& list)
+        {
+            auto it = std::find(list.begin(), list.end(), idx);
+            if (it == list.end())
+                return;
+            if (newIdx != UINT32_MAX)
+                *it = newIdx;
+            else
+            {
+                *it = list.back();
+                list.pop_back();
+            }
+        };
+
+        int lo[3], hi[3];
+        if (!CellRange(GridBox(idx), lo, hi))
+        {
+            replace(m_large);
+            return;
+        }
+        for (int x = lo[0]; x <= hi[0]; ++x)
+        {
+            for (int y = lo[1]; y <= hi[1]; ++y)
+            {
+                for (int z = lo[2]; z <= hi[2]; ++z)
+                {
+                    auto itCell = m_cells.find(CellKey(x, y, z));
+                    replace(itCell->second);
+                    if (itCell->second.empty())
+                        m_cells.erase(itCell);
+                }
+            }
+        }
+    }
+
+    void PartIndex::BuildGrid()
+    {
+        m_hasGrid = true;
+        m_cells.clear();
+        m_large.clear();
+        m_visited.assign(size(), 0);
+        m_visitStamp = 0;
+        for (uint32_t idx = 0; idx < size(); ++idx)
+            GridInsert(idx);
+    }
+}
\ No newline at end of file
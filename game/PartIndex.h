@@ -0,0 +1,108 @@
+#pragma once
+
+#include <vector>
+#include <unordered_map>
+
+namespace sam
+{
+    // Part boxes of one tile in SoA layout, with a sparse uniform grid over
+    // them once there are enough parts for it to pay off.  Boxes are tile
+    // local.  Each part has its rotated collision box and its unrotated
+    // bounds; the grid holds their union.
+    class PartIndex
+    {
+    public:
+        PartIndex();
+
+        // Clears the index for a tile extent units across.
+        void Reset(float extent);
+        // New parts get the next index.
+        void Add(const gmtl::AABoxf& collision, const gmtl::AABoxf& bounds);
+        // Moves the last part into idx, like a swap and pop of the part list.
+        void RemoveSwap(size_t idx);
+        size_t size() const { return m_colMin[0].size(); }
+
+        gmtl::AABoxf CollisionBox(size_t idx) const;
+        gmtl::AABoxf Bounds(size_t idx) const;
+
+        // Calls f(idx) once for every part whose boxes may touch box, stops
+        // early if f returns false.  Returns false if it stopped early.
+        template <typename F> bool ForEachNear(const gmtl::AABoxf& box, F f);
+
+    private:
+        static const int GridDim = 16;
+        static const size_t GridMinParts = 32;
+        // Parts covering more cells than this go in m_large.
+        static const int MaxCellsPerPart = 64;
+
+        std::vector<float> m_colMin[3];
+        std::vector<float> m_colMax[3];
+        std::vector<float> m_bndMin[3];
+        std::vector<float> m_bndMax[3];
+
+        float m_extent;
+        float m_cellSize;
+        bool m_hasGrid;
+        std::unordered_map<uint32_t, std::vector<uint32_t>> m_cells;
+        std::vector<uint32_t> m_large;
+        std::vector<uint32_t> m_visited;
+        uint32_t m_visitStamp;
+
+        bool CellRange(const gmtl::AABoxf& box, int lo[3], int hi[3]) const;
+        gmtl::AABoxf GridBox(size_t idx) const;
+        void GridInsert(uint32_t idx);
+        void GridReplace(uint32_t idx, uint32_t newIdx);
+        void BuildGrid();
+
+        static uint32_t CellKey(int x, int y, int z)
+        { return (uint32_t)((x * GridDim + y) * GridDim + z); }
+    };
+
+    template <typename F> bool PartIndex::ForEachNear(const gmtl::AABoxf& box, F f)
+    {
+        if (!m_hasGrid)
+        {
+            for (size_t idx = 0; idx < size(); ++idx)
+            {
+                if (!f(idx))
+                    return false;
+            }
+            return true;
+        }
+
+        if (++m_visitStamp == 0)
+        {
+            std::fill(m_visited.begin(), m_visited.end(), 0);
+            m_visitStamp = 1;
+        }
+        for (uint32_t idx : m_large)
+        {
+            m_visited[idx] = m_visitStamp;
+            if (!f(idx))
+                return false;
+        }
+        int lo[3], hi[3];
+        CellRange(box, lo, hi);
+        for (int x = lo[0]; x <= hi[0]; ++x)
+        {
+            for (int y = lo[1]; y <= hi[1]; ++y)
+            {
+                for (int z = lo[2]; z <= hi[2]; ++z)
+                {
+                    auto itCell = m_cells.find(CellKey(x, y, z));
+                    if (itCell == m_cells.end())
+                        continue;
+                    for (uint32_t idx : itCell->second)
+                    {
+                        if (m_visited[idx] == m_visitStamp)
+                            continue;
+                        m_visited[idx] = m_visitStamp;
+                        if (!f(idx))
+                            return false;
+                    }
+                }
+            }
+        }
+        return true;
+    }
+}
\ No newline at end of file
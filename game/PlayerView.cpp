@@ -36,7 +36,7 @@ namespace sam
             //make<Quatf>(AxisAnglef(gmtl::Math::PI / 8.0f, 1.0f, 0.0f, 0.0f)));
         PartInst pi;
         pi.id = "3820";
-        m_rightHand->AddItem(std::make_shared<LegoBrick>(pi, 14, true));
+        m_rightHand->AddItem(std::make_shared<LegoBrick>(pi, 14, DetailHires));
         m_playerBody->AddItem(m_rightHand);
         m_playerHead = std::make_shared<SceneGroup>();
         m_playerHead->SetOffset(Vec3f(0, 2.4f, 0));
@@ -72,7 +72,7 @@ namespace sam
         m_rightHandPartInst = part;
         if (!part.id.IsNull())
         {
-            m_rightHandPart = std::make_shared<LegoBrick>(part, part.atlasidx, true, LegoBrick::Physics::None, true);
+            m_rightHandPart = std::make_shared<LegoBrick>(part, part.atlasidx, DetailHires, LegoBrick::Physics::None, true);
             m_rightHandPart->SetOffset(part.pos + Vec3f(0,0,-1.2f));
             m_rightHandPart->SetRotate(part.rot * gmtl::make<Quatf>((AxisAnglef(pi, Vec3f(0,1,0)))));
             float s = 0.25f;
@@ -0,0 +1,37 @@
+#pragma once
+
+#include <atomic>
+#include <memory>
+
+namespace sam
+{
+    // Single value handoff from one producer thread to one consumer thread.
+    // Put replaces (and frees) a value that was never taken.
+    template <typename T> class SpscSlot
+    {
+        std::atomic<T*> m_val;
+    public:
+        SpscSlot() : m_val(nullptr) {}
+        ~SpscSlot()
+        {
+            delete m_val.exchange(nullptr);
+        }
+        SpscSlot(const SpscSlot&) = delete;
+        SpscSlot& operator=(const SpscSlot&) = delete;
+
+        void Put(std::unique_ptr<T> val)
+        {
+            delete m_val.exchange(val.release(), std::memory_order_acq_rel);
+        }
+
+        std::unique_ptr<T> Take()
+        {
+            return std::unique_ptr<T>(m_val.exchange(nullptr, std::memory_order_acq_rel));
+        }
+
+        bool HasValue() const
+        {
+            return m_val.load(std::memory_order_acquire) != nullptr;
+        }
+    };
+}
\ No newline at end of file
@@ -0,0 +1,133 @@
+#include "TileLoader.h"
+#include "Level.h"
+#include "PartChunk.h"
+#include <algorithm>
+
+using namespace gmtl;
+
+namespace sam
+{
+    float LoadPriority(const Loc& l, const Point3f& campos)
+    {
+        float extent = l.GetExtent();
+        float dist = length(Vec3f(l.GetCenter() - campos)) - extent * 0.87f;
+        return extent / std::max(dist, 0.1f);
+    }
+
+    TileLoad::TileLoad(const Loc& l) :
+        m_l(l),
+        m_state(State::Queued)
+    {
+    }
+
+    bool TileLoad::BackgroundLoad(ILevel* level, bool wait)
+    {
+        State expected = State::Queued;
+        if (!m_state.compare_exchange_strong(expected, State::Fetching))
+            return expected == State::Decoded || expected == State::GpuReady;
+
+        std::unique_ptr<LoadedParts> loaded = std::make_unique<LoadedParts>();
+        PacketBuffer buf;
+        bool fetched = true;
+        if (m_l.m_l == 8 && !wait)
+        {
+            fetched = level->GetOctChunk(ILevel::OctKey(m_l, 0), &buf);
+        }
+        else if (m_l.m_l >= 5)
+        {
+            // Waits for the server.  Coarse tiles are merged by the server
+            // from their level 8 children, part positions are already
+            // relative to this tile.
+            std::vector<PacketBuffer> bufs;
+            fetched = level->GetOctChunks({ ILevel::OctKey(m_l, 0) }, &bufs);
+            if (fetched)
+                buf = bufs[0];
+        }
+
+        if (!fetched)
+        {
+            expected = State::Fetching;
+            m_state.compare_exchange_strong(expected, State::Queued);
+            return false;
+        }
+        if (buf.size() > 0)
+            PartChunk::Decode(buf.data(), buf.size(), &loaded->parts);
+        OnFetched(buf, *loaded);
+
+        // Fails if the tile was decommissioned while we were loading it.
+        // Decoded goes first so the main thread never takes the parts and
+        // tries to move on to GpuReady while the tile is still Fetching.
+        expected = State::Fetching;
+        if (!m_state.compare_exchange_strong(expected, State::Decoded))
+            return false;
+        m_loaded.Put(std::move(loaded));
+        return true;
+    }
+
+    std::unique_ptr<TileLoad::LoadedParts> TileLoad::TakeLoaded()
+    {
+        return m_loaded.Take();
+    }
+
+    void TileLoad::SetGpuReady()
+    {
+        State expected = State::Decoded;
+        m_state.compare_exchange_strong(expected, State::GpuReady);
+    }
+
+    int TileLoader::DefaultThreads()
+    {
+        return std::clamp((int)std::thread::hardware_concurrency() - 1, 2, 8);
+    }
+
+    TileLoader::TileLoader(int numThreads) :
+        m_exit(false),
+        m_level(nullptr)
+    {
+        for (int idx = 0; idx < numThreads; ++idx)
+            m_threads.push_back(std::thread(&TileLoader::Run, this));
+    }
+
+    TileLoader::~TileLoader()
+    {
+        {
+            std::lock_guard grd(m_mtx);
+            m_exit = true;
+        }
+        m_cv.notify_all();
+        for (auto& thread : m_threads)
+            thread.join();
+    }
+
+    void TileLoader::SetRequests(ILevel* level, std::vector<Request>& requests)
+    {
+        std::sort(requests.begin(), requests.end(), [](const Request& a, const Request& b)
+            { return a.priority < b.priority; });
+        {
+            std::lock_guard grd(m_mtx);
+            m_level = level;
+            std::swap(m_requests, requests);
+        }
+        m_cv.notify_all();
+    }
+
+    void TileLoader::Run()
+    {
+        std::unique_lock<std::mutex> lk(m_mtx);
+        while (true)
+        {
+            m_cv.wait(lk, [this]() { return m_exit || m_requests.size() > 0; });
+            if (m_exit)
+                break;
+            std::shared_ptr<TileLoad> tile = m_requests.back().tile;
+            m_requests.pop_back();
+            if (tile->GetState() != TileLoad::State::Queued)
+                continue;
+            ILevel* level = m_level;
+            lk.unlock();
+            // Only one thread gets to move the tile out of Queued.
+            tile->BackgroundLoad(level);
+            lk.lock();
+        }
+    }
+}
\ No newline at end of file
@@ -0,0 +1,108 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <gmtl/gmtl.h>
+#include <gmtl/Point.h>
+#include <gmtl/Vec.h>
+#include "Loc.h"
+#include "PartDefs.h"
+#include "SpscSlot.h"
+
+namespace sam
+{
+    class ILevel;
+    class PacketBuffer;
+    class Brick;
+
+    // Roughly the tile's size on screen: near tiles first, and among equally
+    // distant tiles the coarse ones that cover more of the view.
+    float LoadPriority(const Loc& l, const gmtl::Point3f& campos);
+
+    // The part of a tile the loader threads work on.  Kept free of the
+    // renderer so the streaming bench runs the game's own loading.
+    class TileLoad
+    {
+    public:
+        // Loading moves a tile forward through these states.  Loader threads
+        // only touch m_state and m_loaded; the rest of the tile belongs to
+        // the main thread.
+        enum class State : int
+        {
+            Queued,         // Waiting for a loader thread.
+            Fetching,       // A loader thread is fetching and decoding it.
+            Decoded,        // Parts are waiting in m_loaded or to be built.
+            GpuReady,       // Bricks are built and drawing.
+            Decommissioned
+        };
+
+        struct LoadedParts
+        {
+            std::vector<PartInst> parts;
+            std::vector<std::shared_ptr<Brick>> bricks;
+        };
+
+        TileLoad(const Loc& l);
+        virtual ~TileLoad() {}
+
+        // Loader thread.  Returns true once the tile is decoded, false if it
+        // was not Queued or its chunk is still in flight (it goes back to
+        // Queued for the next Update to pick up).  With wait it blocks on
+        // the server instead, and only fails if the fetch does.
+        bool BackgroundLoad(ILevel* level, bool wait = false);
+        // Main thread.  The decoded parts, or null if there are none yet.  A
+        // tile can be Decoded a moment before its parts arrive.
+        std::unique_ptr<LoadedParts> TakeLoaded();
+        // Main thread, once the taken parts are built.
+        void SetGpuReady();
+
+        const Loc& GetLoc() const { return m_l; }
+        State GetState() const
+        { return m_state; }
+
+    protected:
+        Loc m_l;
+        std::atomic<State> m_state;
+        SpscSlot<LoadedParts> m_loaded;
+
+        // Loader thread, after buf is decoded into loaded.parts.
+        virtual void OnFetched(const PacketBuffer& buf, LoadedParts& loaded) {}
+    };
+
+    // Pool of loader threads taking queued tiles highest priority first.
+    class TileLoader
+    {
+    public:
+        struct Request
+        {
+            float priority;
+            std::shared_ptr<TileLoad> tile;
+        };
+
+        // Tile loads mostly wait on the server, so use a few more threads
+        // than the cores we leave to the render thread.
+        static int DefaultThreads();
+
+        TileLoader(int numThreads = DefaultThreads());
+        ~TileLoader();
+
+        // Replaces the queue, so tiles left out of requests drop out.
+        void SetRequests(ILevel* level, std::vector<Request>& requests);
+
+    private:
+        std::vector<std::thread> m_threads;
+        std::mutex m_mtx;
+        std::condition_variable m_cv;
+        bool m_exit;
+        ILevel* m_level;
+        // Sorted by ascending priority, threads take from the back.
+        std::vector<Request> m_requests;
+
+        void Run();
+    };
+}
\ No newline at end of file
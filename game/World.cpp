@@ -101,10 +101,13 @@ namespace sam
         const PartInst& pi = m_pPickedBrick->GetPartInst();
         if (pi.canBeDestroyed)
         {
+            Application::Inst().GetAudio().PlayOnce("break.mp3");
+            if (m_octTileSelection.RemovePart(m_pPickedBrick->GetTileLoc(), m_pPickedBrick->GetTilePart()))
+                return;
+            // Not from a level 8 tile, find the part by position.
             Matrix44f wm = m_pPickedBrick->GetWorldMatrix();
             Vec4f offset;
             xform(offset, wm, Vec4f(0, 0, 0, 1));
-            Application::Inst().GetAudio().PlayOnce("break.mp3");
             PartInst piAdj = pi;
             piAdj.pos = Vec3f(offset);
             m_octTileSelection.RemovePart(piAdj);
@@ -310,7 +313,7 @@ namespace sam
         if (!m_player->InspectMode())
         {
             std::shared_ptr<OctTile> tile = m_octTileSelection.TileFromPos(fly.pos);
-            if (tile == nullptr || tile->GetReadyState() < 3)
+            if (tile == nullptr || tile->GetState() < OctTile::State::Decoded)
             {
             }
             else
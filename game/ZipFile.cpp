@@ -21,6 +21,12 @@ namespace sam
         }
     }
 
+    ZipFile::~ZipFile()
+    {
+        if (m_za != nullptr)
+            zip_discard(m_za);
+    }
+
     vecstream ZipFile::ReadFile(const std::string& name) const
     {
         auto itlores = m_cacheZipIndices.find(name);
@@ -41,7 +47,7 @@ namespace sam
 
     std::istringstream vecstream::readText() const
     {
-        std::istringstream strstr(std::string(m_data.begin(), m_data.end()));
+        std::istringstream strstr(std::string((const char*)m_ptr, m_size));
         return strstr;
     }
 
@@ -60,4 +66,15 @@ namespace sam
         return outfiles;
     }
 
+    std::vector<std::string> ZipFile::ListFiles() const
+    {
+        std::vector<std::string> outfiles;
+        for (const auto& file : m_cacheZipIndices)
+        {
+            if (file.first.size() > 0 && file.first.back() != '/')
+                outfiles.push_back(file.first);
+        }
+        return outfiles;
+    }
+
 }
\ No newline at end of file
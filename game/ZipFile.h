@@ -4,32 +4,48 @@ struct zip;
 
 namespace sam
 {
+    // Reads through either its own buffer or a view of memory owned
+    // elsewhere, such as a mapped AssetPack.
     class vecstream
     {
         std::vector<uint8_t> m_data;
+        const uint8_t* m_ptr;
+        size_t m_size;
         mutable size_t m_offset;
 
     public:
         vecstream(std::vector<uint8_t>&& data) :
-            m_data(data),
+            m_data(std::move(data)),
             m_offset(0)
         {
+            m_ptr = m_data.data();
+            m_size = m_data.size();
+        }
 
+        vecstream(const uint8_t* data, size_t size) :
+            m_ptr(data),
+            m_size(size),
+            m_offset(0)
+        {
         }
 
-        size_t length() const { return m_data.size(); }
-        bool valid() const { return m_data.size() > 0; }
-        vecstream() : m_offset(0) {}
+        size_t length() const { return m_size; }
+        bool valid() const { return m_size > 0; }
+        const uint8_t* data() const { return m_ptr; }
+        vecstream() : m_ptr(nullptr), m_size(0), m_offset(0) {}
 
+        // Moving a vector keeps its buffer, so m_ptr stays valid.
         vecstream(vecstream&& other)
         {
             m_data = std::move(other.m_data);
+            m_ptr = other.m_ptr;
+            m_size = other.m_size;
             m_offset = other.m_offset;
         }
 
         void read(char* outData, size_t size) const
         {
-            memcpy(outData, m_data.data() + m_offset, size);
+            memcpy(outData, m_ptr + m_offset, size);
             m_offset += size;
         }
 
@@ -43,9 +59,12 @@ namespace sam
         zip* m_za;
     public:        
         ZipFile(const std::string& name);
+        ~ZipFile();
 
         vecstream ReadFile(const std::string& name) const;
         std::vector<std::string> ListFiles(const std::string ext) const;
+        // Every file, without directory entries.
+        std::vector<std::string> ListFiles() const;
     };
 
    
@@ -0,0 +1,29 @@
+// Decoding for the packed brick vertex, see BrickVertex.h.
+
+// Center and half extent the positions are quantized to.
+uniform vec4 u_meshBounds[2];
+
+vec3 BrickPosition(vec3 p)
+{
+	return u_meshBounds[0].xyz + p * u_meshBounds[1].xyz;
+}
+
+// Inverse of OctEncode, e is the unorm8 pair.
+vec3 OctDecode(vec2 e)
+{
+	e = e * 2.0 - 1.0;
+	vec3 n = vec3(e.x, e.y, 1.0 - abs(e.x) - abs(e.y));
+	if (n.z < 0.0)
+	{
+		vec2 s = step(vec2_splat(0.0), n.xy) * 2.0 - 1.0;
+		n.xy = (1.0 - abs(n.yx)) * s;
+	}
+	return normalize(n);
+}
+
+// 255 takes the part instance's color.
+float BrickPalette(float p, float partColor)
+{
+	p = floor(p * 255.0 + 0.5);
+	return p == 255.0 ? partColor : p;
+}
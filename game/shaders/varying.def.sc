@@ -8,6 +8,7 @@ vec3 v_view      : TEXCOORD2 = vec3(0.0, 0.0, 0.0);
 vec3 a_position  : POSITION;
 vec2 a_texcoord0 : TEXCOORD0;
 vec3 a_normal : NORMAL;
+vec4 a_color0 : COLOR0;
 
 vec4 i_data0 : TEXCOORD7;
 
@@ -0,0 +1,22 @@
+$input a_position, a_color0
+$output v_vtxcolor, v_texcoord0, v_normal
+
+
+/*
+ * Copyright 2011-2021 Branimir Karadzic. All rights reserved.
+ * License: https://github.com/bkaradzic/bgfx#license-bsd-2-clause
+ */ 
+
+
+#include <bgfx_shader.sh>
+#include "uniforms.sh"
+#include "brick.sh"
+
+// vs_connector for packed brick meshes.
+void main()
+{ 
+	v_texcoord0 = vec2(0.0, 0.0);
+	v_vtxcolor = u_params[0];
+	v_normal = OctDecode(a_color0.xy);
+	gl_Position = mul(u_modelViewProj, vec4(BrickPosition(a_position.xyz), 1.0) );
+}
@@ -1,4 +1,4 @@
-$input a_position, a_texcoord0, a_normal
+$input a_position, a_color0
 $output v_vtxcolor, v_normal
 
 
@@ -10,16 +10,17 @@ $output v_vtxcolor, v_normal
 
 #include <bgfx_shader.sh>
 #include "uniforms.sh"
+#include "brick.sh"
 
 SAMPLER2D(s_brickPalette, 0);
 
 void main()
 { 
-	if (a_texcoord0.x < 0) a_texcoord0.x = u_params[0];
-	float u = fmod(a_texcoord0.x, 16) / 16.0 ;
-	float v = (floor(a_texcoord0.x / 16) / 16.0);
+	float pal = BrickPalette(a_color0.z, u_params[0].x);
+	float u = fmod(pal, 16) / 16.0 ;
+	float v = (floor(pal / 16) / 16.0);
 	vec4 col = texture2DLod(s_brickPalette, vec2(u,v), 0);
 	v_vtxcolor = col;
-	v_normal = a_normal;//mul(u_model[0], vec4(a_normal, 0.0));
-	gl_Position = mul(u_modelViewProj, vec4(a_position.x, a_position.y, a_position.z, 1.0) );
+	v_normal = OctDecode(a_color0.xy);//mul(u_model[0], vec4(a_normal, 0.0));
+	gl_Position = mul(u_modelViewProj, vec4(BrickPosition(a_position.xyz), 1.0) );
 }
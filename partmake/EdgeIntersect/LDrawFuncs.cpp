@@ -7,6 +7,8 @@
 #include <regex>
 #include <map>
 #include <memory>
+#include "../../game/BrickVertex.h"
+#include "../../game/MeshOptimize.h"
 
 struct PosTexcoordNrmVertex
 {
@@ -226,7 +228,6 @@ inline LdrVector getTriangleNormal(const LdrVector& v0,
     return vec_normalize(vec_cross(vec_sub(v1, v0), vec_sub(v2, v0)));
 }
 
-
 #define tricount (hires ? rpart.num_trianglesC : rpart.num_triangles)
 #define tris (hires ? rpart.trianglesC : rpart.triangles)
 void LoadColors(const std::string& ldrpath);
@@ -235,7 +236,7 @@ void GetLdrItem(ldr::Loader* pLoader, BrickThreadPool* threadPool,
     const std::string& name, std::filesystem::path& filepath,
     const std::vector<int> atlasMaterialMapping, bool hires,
     const LdrMatrix *matrix,
-    std::vector<unsigned char> &data)
+    std::vector<unsigned char> &data, bool packed = false)
 {
     if (sColors.size() == 0)
         LoadColors("c:\\lego\\ldraw");
@@ -305,7 +306,7 @@ void GetLdrItem(ldr::Loader* pLoader, BrickThreadPool* threadPool,
     std::vector<uint32_t> idx;
     idx.resize(numidx);
 
-    float bounds[6] = { 1e10,1e10,1e10,-1e10,-1e10,-11e10 };
+    float bounds[6] = { 1e10,1e10,1e10,-1e10,-1e10,-1e10 };
     PosTexcoordNrmVertex* curVtx = (PosTexcoordNrmVertex*)vtx.data();
     uint32_t* curIdx = (uint32_t*)idx.data();
     uint32_t vtxOffset = 0;
@@ -358,7 +359,10 @@ void GetLdrItem(ldr::Loader* pLoader, BrickThreadPool* threadPool,
         }
 
         for (uint32_t idx = 0; idx < tricount * 3; ++idx, curIdx++)
-            *curIdx = *curIdx + vtxOffset;
+        {
+            if (*curIdx != invalidIdx)
+                *curIdx = *curIdx + vtxOffset;
+        }
         if (rpart.materials != nullptr)
         {
             PosTexcoordNrmVertex* pvtx = (PosTexcoordNrmVertex*)vtx.data();
@@ -376,6 +380,54 @@ void GetLdrItem(ldr::Loader* pLoader, BrickThreadPool* threadPool,
         vtxOffset += rpart.num_vertices;
     }
 
+    if (packed)
+    {
+        // Drop triangles with unresolved or repeated vertices, then order
+        // the rest for the post transform cache and vertex fetch.
+        std::vector<uint32_t> triIdx;
+        triIdx.reserve(idx.size());
+        for (size_t i = 0; i + 2 < idx.size(); i += 3)
+        {
+            uint32_t a = idx[i], b = idx[i + 1], c = idx[i + 2];
+            if (a >= numvtx || b >= numvtx || c >= numvtx ||
+                a == b || b == c || a == c)
+                continue;
+            triIdx.push_back(a);
+            triIdx.push_back(b);
+            triIdx.push_back(c);
+        }
+        sam::OptimizeVertexCache(triIdx, numvtx);
+        sam::OptimizeVertexFetch(vtx, triIdx);
+        numvtx = (uint32_t)vtx.size();
+        numidx = (uint32_t)triIdx.size();
+        // 0xFFFF is left out as some APIs treat it as a strip restart.
+        bool index16 = numvtx < 0xFFFF;
+
+        // Game meshes are 12 byte sam::BrickVertex quantized to the bounds.
+        sam::BrickMeshHeader hdr = {};
+        hdr.magic = sam::BrickMeshHeader::Magic;
+        hdr.flags = sam::MeshPacked | (index16 ? sam::MeshIndex16 : 0);
+        hdr.numvtx = numvtx;
+        hdr.numidx = numidx;
+        memcpy(hdr.boundsMin, &bounds[0], sizeof(hdr.boundsMin));
+        memcpy(hdr.boundsMax, &bounds[3], sizeof(hdr.boundsMax));
+        float center[3], scale[3];
+        sam::BrickPackRange(hdr.boundsMin, hdr.boundsMax, center, scale);
+        std::vector<sam::BrickVertex> pvtx(numvtx);
+        for (uint32_t i = 0; i < numvtx; ++i)
+            pvtx[i] = sam::PackBrickVertex(&vtx[i].m_x, &vtx[i].m_nx, vtx[i].m_u, center, scale);
+        data.insert(data.end(), (const char*)&hdr, (const char*)&hdr + sizeof(hdr));
+        data.insert(data.end(), (const char*)pvtx.data(), (const char*)pvtx.data() + sizeof(sam::BrickVertex) * numvtx);
+        if (index16)
+        {
+            std::vector<uint16_t> idx16(triIdx.begin(), triIdx.end());
+            data.insert(data.end(), (const char*)idx16.data(), (const char*)idx16.data() + sizeof(uint16_t) * numidx);
+        }
+        else
+            data.insert(data.end(), (const char*)triIdx.data(), (const char*)triIdx.data() + sizeof(uint32_t) * numidx);
+        return;
+    }
+
     data.insert(data.end(), (const char*)&numvtx, (const char*)&numvtx + sizeof(numvtx));
     data.insert(data.end(), (const char*)vtx.data(), (const char*)vtx.data() + sizeof(PosTexcoordNrmVertex) * numvtx);
     data.insert(data.end(), (const char*)&numidx, (const char*)&numidx + sizeof(numidx));
@@ -485,7 +537,7 @@ extern "C" __declspec(dllexport) void LdrWriteFile(const char* basepath, const c
             std::filesystem::path path(basepath);
             std::vector<unsigned char> outdata;
             GetLdrItem(ldrThLoaderHR.get(), nullptr,
-                name, path, sAtlasMapping, true, (const LdrMatrix*)matptr, outdata);
+                name, path, sAtlasMapping, true, (const LdrMatrix*)matptr, outdata, true);
             std::ofstream file(hrpath, std::ios::binary);
             file.write((char*)outdata.data(), outdata.size());
             file.flush();
@@ -500,7 +552,7 @@ extern "C" __declspec(dllexport) void LdrWriteFile(const char* basepath, const c
             std::filesystem::path path(basepath);
             std::vector<unsigned char> outdata;
             GetLdrItem(ldrThLoaderLR.get(), nullptr,
-                name, path, sAtlasMapping, false, (const LdrMatrix*)matptr, outdata);
+                name, path, sAtlasMapping, false, (const LdrMatrix*)matptr, outdata, true);
             std::ofstream file(lrpath, std::ios::binary);
             file.write((char*)outdata.data(), outdata.size());
             file.flush();
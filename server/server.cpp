@@ -6,50 +6,87 @@
 #include <cxxopts.hpp>
 #include <signal.h>
 #include <stdlib.h>
-#include <unistd.h>
+#include <fstream>
 
 namespace sam
 {
     class Server : public IServerHandler
     {
-        std::unique_ptr<ENetServer> m_server;
+        // Declared first so the db outlives the server's worker threads.
         std::unique_ptr<LevelSvr> m_levelSvr;
+        std::unique_ptr<ENetServer> m_server;
+
+        std::thread m_statsThread;
+        std::mutex m_statsMtx;
+        std::condition_variable m_statsCv;
+        bool m_stopStats = false;
     public:
-        void Run(const std::string &path, const std::string &hostaddr, int hostport)
+        void Run(const std::string &path, const std::string &hostaddr, int hostport, size_t numWorkers)
         {
             std::cout << "Starting Enet server on ip " << hostaddr << " port " << hostport << std::endl;
-            m_server = std::make_unique<ENetServer>(hostaddr, hostport, this);
+            m_server = std::make_unique<ENetServer>(hostaddr, hostport, this, numWorkers);
             m_levelSvr = std::make_unique<LevelSvr>(false);
             std::cout << "Loading level " << path << std::endl;
             m_levelSvr->OpenDb(path);
             m_server->Start();
         }
-        ENetResponse HandleMessage(const ENetMsg::Header* msg)
+        void RequestStop()
         {
-            ENetResponse response;
-            if (msg->m_type == ENetMsg::GetLevelDbValue)
-            {
-                GetLevelValueMsg gmsg;
-                gmsg.ReadData((const uint8_t*)msg);
-                std::string val;
-                bool result = m_levelSvr->GetValue(gmsg.m_key, &response.data);
-                if (!result) response.data = std::string();
-            }
-            else if (msg->m_type == ENetMsg::SetLevelDbValue)
+            m_server->RequestStop();
+        }
+        void Wait()
+        {
+            m_server->Wait();
+        }
+        // Appends the server stats to path every interval until Stop.
+        void DumpStats(const std::string& path, std::chrono::seconds interval)
+        {
+            m_statsThread = std::thread([this, path, interval]()
+                {
+                    std::unique_lock<std::mutex> lk(m_statsMtx);
+                    while (!m_statsCv.wait_for(lk, interval, [this]() { return m_stopStats; }))
+                    {
+                        std::ofstream file(path, std::ios::app);
+                        std::time_t now = std::time(nullptr);
+                        file << "==== " << std::ctime(&now) << m_server->GetStats() << std::endl;
+                    }
+                });
+        }
+        void Stop()
+        {
+            std::cout << "Shutting down" << std::endl;
             {
-                SetLevelValueMsg gmsg;
-                gmsg.ReadData((const uint8_t*)msg);
-                Loc tileLoc;
-                memcpy(&tileLoc, gmsg.m_key.data(), gmsg.m_key.size());
-                std::string val;
-                bool result = m_levelSvr->WriteValue(gmsg.m_key, gmsg.m_data.data(), gmsg.m_data.size());
-                if (!result) response.data = std::string();
-
+                std::lock_guard lock(m_statsMtx);
+                m_stopStats = true;
             }
-            return response;
+            m_statsCv.notify_one();
+            if (m_statsThread.joinable())
+                m_statsThread.join();
+            m_server->Stop();
+            m_levelSvr->CloseDb();
+        }
+        ENetResponse HandleMessage(const ENetMsg::Header* msg)
+        {
+            return m_levelSvr->HandleMessage(msg);
+        }
+        bool IsOrdered(const ENetMsg::Header* msg) const
+        {
+            return m_levelSvr->IsOrdered(msg);
+        }
+        std::string GetStats() const
+        {
+            return m_levelSvr->GetStats();
         }
     };
 }
+static sam::Server* s_server = nullptr;
+
+static void OnSignal(int)
+{
+    if (s_server != nullptr)
+        s_server->RequestStop();
+}
+
 int main(int argc, char** argv)
 {
     cxxopts::Options options("Blocko Server", "Runs Blocko Game Server");
@@ -57,6 +94,10 @@ int main(int argc, char** argv)
         ("l,level", "Load level", cxxopts::value<std::string>())
         ("a,address", "host address", cxxopts::value<std::string>())
         ("p,port", "host port", cxxopts::value<int>())
+        ("w,workers", "Number of request worker threads (default: one per core)", cxxopts::value<int>())
+        ("s,stats", "Append request and leveldb stats to this file periodically", cxxopts::value<std::string>())
+        ("stats-interval", "Seconds between stats dumps (default: 60)", cxxopts::value<int>())
+        ("m,migrate", "Convert tile keys and part chunks of an existing level to the current encodings and exit")
         ("h,help", "Print usage")
         ;
 
@@ -72,6 +113,14 @@ int main(int argc, char** argv)
     if (result.count("level"))
     {
         std::string path(result["level"].as<std::string>());
+        if (result.count("migrate"))
+        {
+            sam::LevelSvr level(false);
+            level.OpenDb(path);
+            size_t converted = level.MigrateOctKeys();
+            std::cout << "Migrated " << converted << " tiles" << std::endl;
+            return 0;
+        }
         sam::Server server;
         std::string hostaddr;
         if (result.count("address"))
@@ -79,13 +128,23 @@ int main(int argc, char** argv)
         int port = 8000;
         if (result.count("port"))
             port = result["port"].as<int>();
-        server.Run(path, hostaddr, port);
-        while (true)
+        size_t numWorkers = 0;
+        if (result.count("workers"))
+            numWorkers = std::max(result["workers"].as<int>(), 1);
+        server.Run(path, hostaddr, port, numWorkers);
+        if (result.count("stats"))
         {
-#ifndef _WIN32
-            usleep(10);
-#endif
+            int interval = 60;
+            if (result.count("stats-interval"))
+                interval = std::max(result["stats-interval"].as<int>(), 1);
+            server.DumpStats(result["stats"].as<std::string>(), std::chrono::seconds(interval));
         }
+        s_server = &server;
+        signal(SIGINT, OnSignal);
+        signal(SIGTERM, OnSignal);
+        server.Wait();
+        server.Stop();
+        s_server = nullptr;
     }
     return 0;
 }
\ No newline at end of file
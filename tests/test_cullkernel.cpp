@@ -0,0 +1,158 @@
+// test_cullkernel.cpp
+// Checks CullOctant and CullOctantScalar against the per box frustum and
+// player tests FrustumTiles used before the kernel, on random octants and
+// frusta.
+#include <stdio.h>
+#include <algorithm>
+#include <cmath>
+#include <random>
+#include <gmtl/gmtl.h>
+#include <gmtl/Generate.h>
+#include <gmtl/FrustumOps.h>
+#include <gmtl/AxisAngle.h>
+#include <gmtl/Quat.h>
+#include <gmtl/QuatOps.h>
+#include "CullKernel.h"
+
+using namespace gmtl;
+
+namespace sam
+{
+    // FrustumTiles::IsChildVisible and what it called before CullOctant.
+    namespace reference
+    {
+        static float Distance(const Planef& plane, const Point3f& pt)
+        {
+            return dot(plane.mNorm, static_cast<Vec3f>(pt)) + plane.mOffset;
+        }
+
+        static bool InFrustum(const Frustumf& f, const AABoxf& box, float& margin)
+        {
+            float disjointMargin = 0;
+            float visibleMargin = std::numeric_limits<float>::max();
+            bool disjoint = false;
+            for (int i = 0; i < 6; i++)
+            {
+                const Planef& plane = f.mPlanes[i];
+                Point3f positive = box.mMin;
+                for (int axis = 0; axis < 3; ++axis)
+                {
+                    if (plane.mNorm[axis] >= 0)
+                        positive[axis] = box.mMax[axis];
+                }
+                float positiveDistance = Distance(plane, positive);
+                if (positiveDistance < 0)
+                {
+                    disjointMargin = std::max(disjointMargin, -positiveDistance);
+                    disjoint = true;
+                    continue;
+                }
+                visibleMargin = std::min(visibleMargin, positiveDistance);
+            }
+            margin = disjoint ? disjointMargin : visibleMargin;
+            return !disjoint;
+        }
+
+        static bool BoxOverlap(const AABoxf& a, const AABoxf& b, float& margin)
+        {
+            float minOverlap = std::numeric_limits<float>::max();
+            float maxGap = 0;
+            for (int i = 0; i < 3; ++i)
+            {
+                float overlap = std::min(a.mMax[i], b.mMax[i]) - std::max(a.mMin[i], b.mMin[i]);
+                minOverlap = std::min(minOverlap, overlap);
+                maxGap = std::max(maxGap, -overlap);
+            }
+            bool overlaps = intersect(a, b);
+            margin = overlaps ? std::max(minOverlap, 0.0f) : maxGap;
+            return overlaps;
+        }
+
+        static bool IsChildVisible(const Frustumf& f, const AABoxf& playerBounds,
+            const AABoxf& cbox, float& margin)
+        {
+            float frustumMargin;
+            bool inFrustum = InFrustum(f, cbox, frustumMargin);
+            float playerMargin;
+            bool intersectsPlayer = BoxOverlap(playerBounds, cbox, playerMargin);
+            if (inFrustum || intersectsPlayer)
+                margin = std::max(inFrustum ? frustumMargin : 0, intersectsPlayer ? playerMargin : 0);
+            else
+                margin = std::min(frustumMargin, playerMargin);
+            return inFrustum || intersectsPlayer;
+        }
+    }
+
+    static Frustumf RandomFrustum(std::mt19937& rng, const Point3f& pos)
+    {
+        std::uniform_real_distribution<float> angle(-3.14159f, 3.14159f);
+        std::uniform_real_distribution<float> fov(30.0f, 100.0f);
+        Quatf rot = make<Quatf>(AxisAnglef(angle(rng), 0.0f, 1.0f, 0.0f)) *
+            make<Quatf>(AxisAnglef(angle(rng) * 0.5f, 1.0f, 0.0f, 0.0f));
+        Matrix44f view = make<Matrix44f>(rot);
+        setTrans(view, Vec3f(pos));
+        invert(view);
+        Matrix44f proj;
+        setPerspective(proj, fov(rng), 16.0f / 9.0f, 0.1f, 150.0f);
+        Frustumf f(view, proj);
+        normalize(f);
+        return f;
+    }
+
+    static bool Close(float a, float b)
+    {
+        return fabsf(a - b) <= 1e-4f * std::max(1.0f, std::max(fabsf(a), fabsf(b)));
+    }
+
+    static int Run(int iterations)
+    {
+        std::mt19937 rng(1);
+        std::uniform_real_distribution<float> unit(-1.0f, 1.0f);
+        std::uniform_int_distribution<int> level(0, 7);
+        int failures = 0;
+        for (int iter = 0; iter < iterations && failures < 20; ++iter)
+        {
+            int l = level(rng);
+            std::uniform_int_distribution<int> coord(0, (1 << l) - 1);
+            Loc parent(coord(rng), coord(rng), coord(rng), l);
+            float extent = parent.GetExtent();
+            Point3f center = parent.GetCenter();
+            Point3f campos = center + Vec3f(unit(rng), unit(rng), unit(rng)) * extent;
+            Frustumf f = RandomFrustum(rng, campos);
+            Vec3f playerExt = Vec3f(fabsf(unit(rng)), fabsf(unit(rng)), fabsf(unit(rng))) * (extent * 0.25f);
+            Point3f playerPos = center + Vec3f(unit(rng), unit(rng), unit(rng)) * extent;
+            AABoxf playerBounds(playerPos - playerExt, playerPos + playerExt);
+
+            OctantBoxes boxes;
+            boxes.SetChildren(parent);
+            float simdMargins[8], scalarMargins[8];
+            uint8_t simd = CullOctant(f, playerBounds, boxes, simdMargins);
+            uint8_t scalar = CullOctantScalar(f, playerBounds, boxes, scalarMargins);
+            for (int idx = 0; idx < 8; ++idx)
+            {
+                float refMargin;
+                bool ref = reference::IsChildVisible(f, playerBounds, parent.GetChild(idx).GetBBox(), refMargin);
+                bool simdVisible = (simd >> idx) & 1;
+                bool scalarVisible = (scalar >> idx) & 1;
+                // Results right on a boundary may round either way.
+                bool onBoundary = refMargin <= 1e-4f * extent;
+                if (simdVisible != scalarVisible || !Close(simdMargins[idx], scalarMargins[idx]) ||
+                    (!onBoundary && (scalarVisible != ref || !Close(scalarMargins[idx], refMargin))))
+                {
+                    printf("iteration %d child %d: simd %d %g, scalar %d %g, reference %d %g\n",
+                        iter, idx, simdVisible, simdMargins[idx], scalarVisible, scalarMargins[idx],
+                        ref, refMargin);
+                    failures++;
+                }
+            }
+        }
+        return failures;
+    }
+}
+
+int main()
+{
+    int failures = sam::Run(100000);
+    printf("%s\n", failures == 0 ? "passed" : "FAILED");
+    return failures == 0 ? 0 : 1;
+}
\ No newline at end of file